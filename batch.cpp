@@ -0,0 +1,73 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "input.h"
+#include "prune.h"
+
+using std::vector;
+
+
+vector<vector<keyentry>> ParseBatchListing(SpecSet const& specs, std::string_view data,
+		char delim, std::ostream &warn)
+{
+	vector<LineParser> parsers;
+	for (size_t i = 0; i < specs.Size(); i++)
+		parsers.emplace_back(specs[i]);
+
+	vector<vector<keyentry>> groups(specs.Size());
+	ForEachLine(data, delim, [&](std::string_view line) {
+		size_t i = specs.Find(line);
+		if (i == SpecSet::npos) {
+			warn << "warn: spec does not match input: " << line << "\n";
+			return;
+		}
+		timekey key;
+		if (parsers[i].Parse(line, key, warn))
+			groups[i].push_back(keyentry{ key, uint64_t(line.data() - data.data()) });
+	});
+	return groups;
+}
+
+vector<Bitmap> FindBatchKeep(vector<vector<keyentry>> &groups,
+		vector<vector<keeptier>> const& tiers, size_t jobs)
+{
+	vector<Bitmap> keep;
+	for (vector<keyentry> const& group : groups)
+		keep.emplace_back(group.size());
+
+	// Groups are handed out one at a time, they can be very different in size
+	std::atomic<size_t> next(0);
+	auto work = [&]() {
+		for (size_t i = next++; i < groups.size(); i = next++) {
+			if (groups[i].empty())
+				continue;
+			RadixSortDescending(groups[i]);
+			FindPruneKeep(groups[i], tiers[i], keep[i]);
+		}
+	};
+	size_t threads = std::min(jobs, groups.size());
+	vector<std::thread> workers;
+	for (size_t t = 1; t < threads; t++)
+		workers.emplace_back(work);
+	work();
+	for (std::thread &t : workers)
+		t.join();
+	return keep;
+}
@@ -0,0 +1,37 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <cstddef>
+#include <iostream>
+#include <string_view>
+#include <vector>
+
+#include "retention.h"
+#include "spec.h"
+#include "timekey.h"
+
+
+/* Splits a listing between specs in one pass. Entry lists come back in the order of specs,
+ * unsorted, pointing into data. Lines that no spec matches are warned about like --prune does.
+ */
+std::vector<std::vector<keyentry>> ParseBatchListing(SpecSet const& specs, std::string_view data,
+		char delim, std::ostream &warn = std::cerr);
+
+/* Sorts every group and works out what it keeps under its own tiers, with up to jobs groups
+ * at a time.
+ */
+std::vector<Bitmap> FindBatchKeep(std::vector<std::vector<keyentry>> &groups,
+		std::vector<std::vector<keeptier>> const& tiers, size_t jobs);
@@ -0,0 +1,70 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+/* Minimal self-contained benchmark harness. Each benchmark body is run a few times and the
+ * fastest and median run are reported per item, so noise shows up as a gap between the two.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+
+struct bench_config {
+	int iterations = 5;
+	// Only benchmarks whose name contains this are run
+	std::string filter;
+};
+
+// Keeps the compiler from optimizing away results that are otherwise unused.
+template <typename T>
+inline void DoNotOptimize(T const& value)
+{
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+/* Runs body() config.iterations times. items is how many things one run processes, bytes how
+ * much input it reads (0 if that doesn't make sense).
+ */
+template <typename F>
+void Bench(bench_config const& config, std::string const& name, size_t items, size_t bytes,
+		F&& body)
+{
+	if (!config.filter.empty() && name.find(config.filter) == std::string::npos)
+		return;
+	if (items == 0)
+		items = 1;
+
+	std::vector<double> runs;
+	for (int i = 0; i < std::max(1, config.iterations); i++) {
+		auto begin = std::chrono::steady_clock::now();
+		body();
+		auto end = std::chrono::steady_clock::now();
+		runs.push_back(std::chrono::duration<double>(end - begin).count());
+	}
+	std::sort(runs.begin(), runs.end());
+	double best = runs.front();
+	double median = runs[runs.size() / 2];
+
+	std::printf("%-28s %10zu items %10.2f ns/item (median %10.2f)", name.c_str(), items,
+			best * 1e9 / items, median * 1e9 / items);
+	if (bytes)
+		std::printf(" %9.1f MB/s", bytes / best / 1e6);
+	std::printf("\n");
+	std::fflush(stdout);
+}
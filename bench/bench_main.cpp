@@ -0,0 +1,332 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/* Benchmarks for the --prune pipeline. Each stage (timestamp parsing, spec validation, sorting,
+ * retention and output) is measured on its own, then all of them together, on a synthetic
+ * listing.
+ *
+ * usage: filetimegen_bench [OPTIONS]
+ *     --size N         lines in the listing (default 100000)
+ *     --interval S     seconds between entries (default 60)
+ *     --jitter S       move entries by up to S seconds either way (default 0)
+ *     --invalid F      fraction of rejected lines (default 0.01)
+ *     --spec SPEC      spec the names are generated from (default home-{now})
+ *     --sorted         most recent first instead of shuffled
+ *     --jobs N         threads for the end to end benchmark (default 1)
+ *     --iterations N   runs per benchmark (default 5)
+ *     --filter TEXT    only run benchmarks whose name contains TEXT
+ *     --binary PATH    filetimegen to time startup of (default: next to this one)
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <regex>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "listing.h"
+#include "../input.h"
+#include "../output.h"
+#include "../prune.h"
+#include "../retention.h"
+#include "../spec.h"
+#include "../timekey.h"
+#include "../timestruct.h"
+
+using std::string;
+using std::vector;
+
+
+// The parse step of timestruct(string) before the fixed-width parser, kept here for comparison.
+static bool RegexParse(string const& intime, int &year, int &mon, int &mday,
+		int &hour, int &min, int &sec)
+{
+	std::regex nowre(R"HERE((\d{4})-(\d{2})-(\d{2})T(\d{2}):(\d{2}):(\d{2}))HERE");
+	std::smatch sm;
+	if (!std::regex_match(intime.cbegin(), intime.cend(), sm, nowre))
+		return false;
+	year = std::stoi(sm[1]);
+	mon = std::stoi(sm[2]);
+	mday = std::stoi(sm[3]);
+	hour = std::stoi(sm[4]);
+	min = std::stoi(sm[5]);
+	sec = std::stoi(sm[6]);
+	return true;
+}
+
+// The regex path is slow enough that it only gets a sample of the listing.
+static const size_t REGEX_SAMPLE = 5000;
+
+// A typical mix of tiers, the same as "-M 60 -H 24 -d 7 -w 4 -m 6".
+static vector<keeptier> BenchTiers()
+{
+	return {
+		keeptier{ 60, bucketing{ BUCKET_MINUTE, 0 } },
+		keeptier{ 24, bucketing{ BUCKET_HOUR, 0 } },
+		keeptier{ 7, bucketing{ BUCKET_DAY, 0 } },
+		keeptier{ 4, bucketing{ BUCKET_WEEK, 0 } },
+		keeptier{ 6, bucketing{ BUCKET_MONTH, 0 } },
+	};
+}
+
+static void RunBenchmarks(bench_config const& config, listing_options const& opts, size_t jobs)
+{
+	string data = GenerateListing(opts);
+	CompiledSpec spec(opts.spec);
+	std::ostream discard(nullptr);
+
+	vector<std::string_view> lines;
+	ForEachLine(data, opts.delim, [&lines](std::string_view line) { lines.push_back(line); });
+	vector<std::string_view> nows;
+	for (std::string_view line : lines) {
+		if (spec.Matches(line))
+			nows.push_back(spec.Now(line));
+	}
+	std::printf("listing: %zu lines, %zu bytes, spec '%s'\n\n", lines.size(), data.size(),
+			opts.spec.c_str());
+
+	vector<char const*> now_ptrs;
+	for (std::string_view s : nows)
+		now_ptrs.push_back(s.data());
+	vector<timekey> batch_keys(nows.size());
+	std::unique_ptr<bool[]> batch_valid(new bool[nows.size()]);
+	// The ISO parsers read NOW_SPEC_LENGTH bytes, which other {now:fmt} formats don't have
+	if (&spec.NowFormat() == &DefaultNowFormat()) {
+		vector<string> regex_sample(nows.begin(),
+				nows.begin() + std::min(nows.size(), REGEX_SAMPLE));
+		Bench(config, "parse/regex", regex_sample.size(), 0, [&]() {
+			int year, mon, mday, hour, min, sec;
+			for (string const& s : regex_sample) {
+				DoNotOptimize(RegexParse(s, year, mon, mday, hour, min, sec));
+				DoNotOptimize(year);
+			}
+		});
+		Bench(config, "parse/fixed-width", nows.size(), 0, [&]() {
+			int year, mon, mday, hour, min, sec;
+			for (std::string_view s : nows) {
+				DoNotOptimize(ParseNowSpec(s, year, mon, mday, hour, min, sec));
+				DoNotOptimize(year);
+			}
+		});
+		Bench(config, "parse/timestruct", nows.size(), 0, [&]() {
+			for (std::string_view s : nows) {
+				try {
+					DoNotOptimize(timestruct(s).tp);
+				}
+				catch (std::invalid_argument const&) {
+				}
+			}
+		});
+		Bench(config, "parse/timekey", nows.size(), 0, [&]() {
+			timekey key;
+			for (std::string_view s : nows) {
+				DoNotOptimize(ParseTimeKey(s, key));
+				DoNotOptimize(key);
+			}
+		});
+		Bench(config, "parse/ParseTimeKeys", nows.size(), 0, [&]() {
+			ParseTimeKeys(now_ptrs.data(), now_ptrs.size(), batch_keys.data(), batch_valid.get());
+			DoNotOptimize(batch_keys.back());
+		});
+	}
+	Bench(config, "parse/NowFormat", nows.size(), 0, [&]() {
+		spec.NowFormat().parse(now_ptrs.data(), now_ptrs.size(), batch_keys.data(),
+				batch_valid.get());
+		DoNotOptimize(batch_keys.back());
+	});
+
+	Bench(config, "validate/ValidateInputSpec", lines.size(), data.size(), [&]() {
+		for (std::string_view line : lines)
+			DoNotOptimize(ValidateInputSpec(spec, line));
+	});
+
+	LineParser parser(spec);
+	vector<keyentry> parsed;
+	for (std::string_view line : lines) {
+		timekey key;
+		if (parser.Parse(line, key, discard))
+			parsed.push_back(keyentry{ key, uint64_t(line.data() - data.data()) });
+	}
+	Bench(config, "sort/std::sort", parsed.size(), 0, [&]() {
+		vector<keyentry> copy = parsed;
+		std::sort(copy.begin(), copy.end(),
+				[](keyentry const& l, keyentry const& r) { return l.key > r.key; });
+		DoNotOptimize(copy.data());
+	});
+	Bench(config, "sort/RadixSortDescending", parsed.size(), 0, [&]() {
+		vector<keyentry> copy = parsed;
+		RadixSortDescending(copy);
+		DoNotOptimize(copy.data());
+	});
+
+	vector<keyentry> sorted = parsed;
+	RadixSortDescending(sorted);
+	vector<keeptier> tiers = BenchTiers();
+	Bench(config, "retention/FindPruneKeep", sorted.size(), 0, [&]() {
+		Bitmap keep(sorted.size());
+		FindPruneKeep(sorted, tiers, keep);
+		DoNotOptimize(keep);
+	});
+	// Realistic policies stop early, this one has to look at every entry.
+	vector<keeptier> unbounded(tiers.size());
+	std::transform(tiers.begin(), tiers.end(), unbounded.begin(),
+			[&sorted](keeptier t) { return keeptier{ sorted.size(), t.bucket }; });
+	Bench(config, "retention/FindPruneKeep-all", sorted.size(), 0, [&]() {
+		Bitmap keep(sorted.size());
+		FindPruneKeep(sorted, unbounded, keep);
+		DoNotOptimize(keep);
+	});
+
+	// Same policy on the listing as it was read, without sorting it first
+	Bench(config, "retention/FindPruneKeepUnsorted", parsed.size(), 0, [&]() {
+		Bitmap keep(parsed.size());
+		FindPruneKeepUnsorted(parsed, tiers, keep);
+		DoNotOptimize(keep);
+	});
+
+	vector<timestruct> times;
+	for (std::string_view s : nows) {
+		try {
+			times.push_back(timestruct(s));
+		}
+		catch (std::invalid_argument const&) {
+		}
+	}
+	Bench(config, "output/GenerateFileTime", times.size(), 0, [&]() {
+		for (timestruct const& t : times)
+			DoNotOptimize(GenerateFileTime(spec, t).size());
+	});
+
+	int devnull = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	if (devnull < 0)
+		throw std::runtime_error("failed to open /dev/null");
+	Bitmap keep(sorted.size());
+	FindPruneKeep(sorted, tiers, keep);
+	Bench(config, "output/WritePruned", sorted.size(), 0, [&]() {
+		OutputBuffer out(devnull);
+		WritePruned(sorted, keep, data, spec.NameLength(), opts.delim, out);
+		out.Flush();
+	});
+
+	Bench(config, "e2e/prune", lines.size(), data.size(), [&]() {
+		vector<keyentry> entries = ParseListing(parser, data, opts.delim, jobs, discard);
+		Bitmap e2e_keep(entries.size());
+		FindPruneKeep(entries, tiers, e2e_keep);
+		OutputBuffer out(devnull);
+		WritePruned(entries, e2e_keep, data, spec.NameLength(), opts.delim, out);
+		out.Flush();
+	});
+	Bench(config, "e2e/prune-unordered", lines.size(), data.size(), [&]() {
+		vector<keyentry> entries = ParseListingUnsorted(parser, data, opts.delim, jobs, discard);
+		Bitmap e2e_keep(entries.size());
+		FindPruneKeepUnsorted(entries, tiers, e2e_keep);
+		OutputBuffer out(devnull);
+		WritePruned(entries, e2e_keep, data, spec.NameLength(), opts.delim, out);
+		out.Flush();
+	});
+	close(devnull);
+}
+
+// Runs per startup benchmark iteration, process startup is slow enough that this is plenty
+static const size_t STARTUP_RUNS = 200;
+
+/* Times fork+exec of binary in generation mode through to its exit, the way hooks call it.
+ */
+static void RunStartupBenchmarks(bench_config const& config, string const& binary)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+	auto run = [&](vector<char const*> args) {
+		args.insert(args.begin(), binary.c_str());
+		args.push_back(nullptr);
+		for (size_t i = 0; i < STARTUP_RUNS; i++) {
+			pid_t pid;
+			int err = posix_spawn(&pid, binary.c_str(), &actions, nullptr,
+					const_cast<char **>(args.data()), environ);
+			if (err != 0)
+				throw std::runtime_error("failed to run " + binary + ": " + std::strerror(err));
+			int status;
+			if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+				throw std::runtime_error(binary + " failed");
+		}
+	};
+	Bench(config, "startup/generate", STARTUP_RUNS, 0, [&]() { run({ "home-{now}" }); });
+	Bench(config, "startup/generate-utc", STARTUP_RUNS, 0,
+			[&]() { run({ "home-{now}", "--utc" }); });
+	posix_spawn_file_actions_destroy(&actions);
+}
+
+static char const* NextArg(int &i, int argc, char **argv)
+{
+	if (++i >= argc)
+		throw std::invalid_argument(string("option '") + argv[i - 1] + "' requires an argument");
+	return argv[i];
+}
+
+int main(int argc, char **argv)
+{
+	bench_config config;
+	listing_options opts;
+	size_t jobs = 1;
+	string binary = argv[0];
+	binary = binary.substr(0, binary.rfind('/') + 1) + "filetimegen";
+	try {
+		for (int i = 1; i < argc; i++) {
+			string arg(argv[i]);
+			if (arg == "--size")
+				opts.size = std::strtoull(NextArg(i, argc, argv), nullptr, 10);
+			else if (arg == "--interval")
+				opts.interval = std::strtoll(NextArg(i, argc, argv), nullptr, 10);
+			else if (arg == "--jitter")
+				opts.jitter = std::strtoll(NextArg(i, argc, argv), nullptr, 10);
+			else if (arg == "--invalid")
+				opts.invalid = std::strtod(NextArg(i, argc, argv), nullptr);
+			else if (arg == "--spec")
+				opts.spec = NextArg(i, argc, argv);
+			else if (arg == "--sorted")
+				opts.shuffle = false;
+			else if (arg == "--jobs")
+				jobs = std::max(1ull, std::strtoull(NextArg(i, argc, argv), nullptr, 10));
+			else if (arg == "--iterations")
+				config.iterations = std::atoi(NextArg(i, argc, argv));
+			else if (arg == "--filter")
+				config.filter = NextArg(i, argc, argv);
+			else if (arg == "--binary")
+				binary = NextArg(i, argc, argv);
+			else
+				throw std::invalid_argument("invalid argument: " + arg);
+		}
+		if (CompiledSpec(opts.spec).NowCount() == 0)
+			throw std::invalid_argument("--spec must contain {now} somewhere");
+		RunBenchmarks(config, opts, jobs);
+		RunStartupBenchmarks(config, binary);
+	}
+	catch (std::exception const& e) {
+		std::cerr << e.what() << "\n";
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,346 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/* Differential test of the --prune paths against the reference implementation. Every case is a
+ * random listing and policy, some of them deliberately awkward: duplicates, out of range fields
+ * that have to be normalized, malformed names, year and ISO week boundaries, sorted input in
+ * both directions, every {now:fmt}, tiers that keep 0. Names are written in the local time of
+ * --tz, which has DST, so the wall clock formats repeat an hour in the autumn. All paths have to
+ * prune exactly what the reference prunes, and how fast each one was relative to it is reported
+ * at the end.
+ *
+ * usage: filetimegen_diff [OPTIONS]
+ *     --cases N        number of cases (default 200)
+ *     --size N         most lines in a case (default 20000)
+ *     --seed N         seed of the first case, case i uses seed + i (default 1)
+ *     --jobs N         threads for the parallel paths (default 4)
+ *     --tz ZONE        time zone the names are written in (default Europe/Berlin)
+ *     --verbose        print every case, not just the ones that fail
+ *
+ * Exits with 1 if any case fails. A failing case can be run again on its own with
+ * --seed <its seed> --cases 1.
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "differential.h"
+
+using std::string;
+using std::vector;
+
+
+static char const* const SPECS[] = {
+	"home-{now}", "{now}", "db-{now}.dump", "a{now}b{now}c", "{now}{now}",
+	"home-{now:iso-ms}", "{now:iso-z}", "db-{now:iso-offset}.dump", "{now:epoch}",
+	"snap-{now:epoch-ms}", "a{now:epoch}b{now:iso-ms}c",
+};
+
+// Seconds since 1970-01-01 of some times that are easy to get wrong
+static const int64_t ANCHORS[] = {
+	0,             // 1970-01-01, a Thursday in the middle of ISO week 1
+	-259200,       // 1969-12-29, the Monday that starts it
+	951782400,     // 2000-02-29
+	1609372800,    // 2020-12-31, in ISO week 2020-W53
+	1609718400,    // 2021-01-04, the first Monday of 2021-W01
+	4102444800,    // 2100-01-01, not a leap year
+	-62167219200,  // 0000-01-01
+	253402214400,  // 9999-12-31, the last day that fits
+	1585450800,    // 2020-03-29 03:00 UTC, two hours after Europe/Berlin skipped one
+	1603594800,    // 2020-10-25 02:00 UTC, an hour after it went through one twice
+};
+
+// Milliseconds
+static const int64_t STEPS[] = {
+	1, 250, 999, 1000, 59000, 60000, 61000, 3600000, 86399000, 86400000, 7 * 86400000ll,
+	31 * 86400000ll,
+};
+
+static const bucketunit UNITS[] = {
+	BUCKET_MINUTE, BUCKET_HOUR, BUCKET_DAY, BUCKET_WEEK, BUCKET_MONTH, BUCKET_QUARTER, BUCKET_YEAR,
+	BUCKET_MINUTES,
+};
+
+template <typename T, size_t N>
+static T const& Pick(std::mt19937_64 &rng, T const (&items)[N])
+{
+	return items[rng() % N];
+}
+
+static int64_t FloorDivide(int64_t a, int64_t b)
+{
+	return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+// The {now:fmt} value of ms since 1970-01-01 UTC, like FormatNow() and friends would write it
+static string FormatValue(string const& format, int64_t ms)
+{
+	time_t t = FloorDivide(ms, 1000);
+	char buf[64];
+	if (format == "epoch" || format == "epoch-ms") {
+		long long value = format == "epoch" ? (long long)t : (long long)ms;
+		std::snprintf(buf, sizeof(buf), format == "epoch" ? "%010lld" : "%013lld", value);
+		return buf;
+	}
+	std::tm tm;
+	if (format == "iso-z")
+		gmtime_r(&t, &tm);
+	else
+		localtime_r(&t, &tm);
+	std::snprintf(buf, sizeof(buf), "%04d-%02d-%02dT%02d:%02d:%02d",
+			tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+	string value = buf;
+	if (format == "iso-ms") {
+		std::snprintf(buf, sizeof(buf), ".%03d", int(ms - int64_t(t) * 1000));
+		value += buf;
+	}
+	else if (format == "iso-z")
+		value += 'Z';
+	else if (format == "iso-offset") {
+		long minutes = std::labs(tm.tm_gmtoff) / 60;
+		std::snprintf(buf, sizeof(buf), "%c%02ld:%02ld", tm.tm_gmtoff < 0 ? '-' : '+',
+				minutes / 60, minutes % 60);
+		value += buf;
+	}
+	return value;
+}
+
+// Breaks value in one of the ways a listing can be broken, or writes a field out of range
+static void Mangle(std::mt19937_64 &rng, string &value)
+{
+	// Offsets of the month, day, hour, minute and second digits
+	static const size_t FIELDS[] = { 5, 8, 11, 14, 17 };
+	switch (rng() % 6) {
+	case 0: {
+		if (value.size() < FIELDS[4] + 2) {
+			// An epoch, any digits are a valid time
+			value[rng() % value.size()] = char('0' + rng() % 10);
+			break;
+		}
+		// Out of range, but still two digits: rolls over into the next field
+		size_t f = Pick(rng, FIELDS);
+		int v = rng() % 3 == 0 ? 0 : int(rng() % 100);
+		value[f] = char('0' + v / 10);
+		value[f + 1] = char('0' + v % 10);
+		break;
+	}
+	case 1:
+		value[rng() % value.size()] = char("x /:T-9\x80"[rng() % 8]);
+		break;
+	case 2:
+		value.erase(rng() % value.size(), 1);
+		break;
+	case 3:
+		value.insert(rng() % value.size(), 1, '0');
+		break;
+	case 4:
+		// Separators in the wrong place
+		std::swap(value[4], value[rng() % value.size()]);
+		break;
+	default:
+		value.clear();
+		break;
+	}
+}
+
+static diff_case GenerateCase(std::mt19937_64 &rng, size_t max_size)
+{
+	diff_case c;
+	c.spec = Pick(rng, SPECS);
+	c.delim = rng() % 2 ? '\0' : '\n';
+
+	size_t size = rng() % 4 == 0 ? rng() % 10 + 1 : rng() % max_size + 1;
+	int64_t base = (rng() % 2 ? Pick(rng, ANCHORS)
+		: int64_t(rng() % 4102444800)) * 1000; // anywhere from 1970 to 2100
+	int64_t step = Pick(rng, STEPS);
+	int64_t jitter = rng() % 2 ? int64_t(rng() % (step + 1)) : 0;
+	double duplicates = rng() % 3 == 0 ? 0.05 : 0;
+	double mangled = std::uniform_real_distribution<double>(0, 0.3)(rng);
+	std::uniform_real_distribution<double> coin(0, 1);
+
+	vector<int64_t> instants;
+	for (size_t i = 0; i < size; i++) {
+		int64_t ms = base - int64_t(i) * step;
+		if (jitter)
+			ms += int64_t(rng() % (2 * jitter + 1)) - jitter;
+		instants.push_back(ms);
+	}
+	// Shuffled, most recent first or oldest first
+	switch (rng() % 3) {
+	case 0:
+		std::shuffle(instants.begin(), instants.end(), rng);
+		break;
+	case 1:
+		std::sort(instants.rbegin(), instants.rend());
+		break;
+	default:
+		std::sort(instants.begin(), instants.end());
+		break;
+	}
+
+	vector<string> names;
+	for (int64_t ms : instants) {
+		if (!names.empty() && coin(rng) < duplicates) {
+			names.push_back(names[rng() % names.size()]);
+			continue;
+		}
+		bool mangle = coin(rng) < mangled;
+		string name = c.spec;
+		for (size_t pos; (pos = name.find("{now")) != string::npos; ) {
+			size_t end = name.find('}', pos);
+			string format = name[pos + 4] == ':' ? name.substr(pos + 5, end - pos - 5) : "iso";
+			string value = FormatValue(format, ms);
+			if (mangle)
+				Mangle(rng, value);
+			name.replace(pos, end + 1 - pos, value);
+		}
+		if (!name.empty() && coin(rng) < mangled / 4)
+			name[rng() % name.size()] ^= 1; // usually breaks the literal text
+		names.push_back(name);
+	}
+	for (string const& name : names) {
+		c.data += name;
+		c.data += c.delim;
+	}
+	if (!c.data.empty() && rng() % 4 == 0)
+		c.data.pop_back(); // no delimiter after the last line
+
+	size_t tiers = rng() % 5;
+	for (size_t i = 0; i < tiers; i++) {
+		keeptier tier;
+		tier.bucket.unit = Pick(rng, UNITS);
+		tier.bucket.width = tier.bucket.unit == BUCKET_MINUTES ? int64_t(rng() % 2880 + 1) : 0;
+		switch (rng() % 8) {
+		case 0:
+			tier.keep = rng() % 1000 + 1;
+			break;
+		case 2:
+			// Newest only, except for the library which turns it down
+			tier.keep = 0;
+			break;
+		case 1:
+			// More than the top-K path takes without falling back to a sort
+			tier.keep = 5000;
+			break;
+		default:
+			tier.keep = rng() % 30 + 1;
+			break;
+		}
+		c.tiers.push_back(tier);
+	}
+	return c;
+}
+
+static char const* NextArg(int &i, int argc, char **argv)
+{
+	if (++i >= argc)
+		throw std::invalid_argument(string("option '") + argv[i - 1] + "' requires an argument");
+	return argv[i];
+}
+
+int main(int argc, char **argv)
+{
+	size_t cases = 200;
+	size_t max_size = 20000;
+	uint64_t seed = 1;
+	size_t jobs = 4;
+	bool verbose = false;
+	char const* tz = "Europe/Berlin";
+	try {
+		for (int i = 1; i < argc; i++) {
+			string arg(argv[i]);
+			if (arg == "--cases")
+				cases = std::strtoull(NextArg(i, argc, argv), nullptr, 10);
+			else if (arg == "--size")
+				max_size = std::max(1ull, std::strtoull(NextArg(i, argc, argv), nullptr, 10));
+			else if (arg == "--seed")
+				seed = std::strtoull(NextArg(i, argc, argv), nullptr, 10);
+			else if (arg == "--jobs")
+				jobs = std::max(1ull, std::strtoull(NextArg(i, argc, argv), nullptr, 10));
+			else if (arg == "--tz")
+				tz = NextArg(i, argc, argv);
+			else if (arg == "--verbose")
+				verbose = true;
+			else
+				throw std::invalid_argument("invalid argument: " + arg);
+		}
+	}
+	catch (std::exception const& e) {
+		std::cerr << e.what() << "\n";
+		return 1;
+	}
+	setenv("TZ", tz, 1);
+	tzset();
+
+	struct total {
+		char const* name;
+		size_t cases = 0;
+		size_t lines = 0;
+		double seconds = 0;
+		double reference = 0; // reference time over the same cases
+	};
+	vector<total> totals;
+	size_t failed = 0;
+	for (size_t n = 0; n < cases; n++) {
+		std::mt19937_64 rng(seed + n);
+		diff_case c = GenerateCase(rng, max_size);
+		size_t lines = std::count(c.data.begin(), c.data.end(), c.delim) + 1;
+		vector<path_result> results = RunPaths(c, jobs);
+		string mismatch = FindMismatch(results);
+
+		if (totals.empty()) {
+			for (path_result const& r : results)
+				totals.push_back(total{ r.name });
+		}
+		for (size_t i = 0; i < results.size(); i++) {
+			if (!results[i].ran)
+				continue;
+			totals[i].cases++;
+			totals[i].lines += lines;
+			totals[i].seconds += results[i].seconds;
+			totals[i].reference += results[0].seconds;
+		}
+
+		if (!mismatch.empty() || verbose) {
+			std::printf("seed %llu: spec '%s', %zu lines, %zu tiers, %zu pruned",
+					(unsigned long long)(seed + n), c.spec.c_str(), lines, c.tiers.size(),
+					results[0].pruned.size());
+			for (path_result const& r : results) {
+				if (r.ran && r.seconds > 0 && &r != &results[0])
+					std::printf(", %s %.1fx", r.name, results[0].seconds / r.seconds);
+			}
+			std::printf("\n");
+		}
+		if (!mismatch.empty()) {
+			std::printf("  MISMATCH: %s\n", mismatch.c_str());
+			failed++;
+		}
+		std::fflush(stdout);
+	}
+
+	std::printf("\n%-14s %8s %12s %14s %10s\n", "path", "cases", "lines", "ns/line", "speedup");
+	for (total const& t : totals) {
+		std::printf("%-14s %8zu %12zu %14.1f %9.1fx\n", t.name, t.cases, t.lines,
+				t.lines ? t.seconds * 1e9 / t.lines : 0.0,
+				t.seconds > 0 ? t.reference / t.seconds : 0.0);
+	}
+	std::printf("\n%zu of %zu cases failed\n", failed, cases);
+	return failed ? 1 : 0;
+}
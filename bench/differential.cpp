@@ -0,0 +1,394 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "differential.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_set>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "reference.h"
+#include "../batch.h"
+#include "../filetimegen.h"
+#include "../input.h"
+#include "../prune.h"
+#include "../source.h"
+#include "../spec.h"
+#include "../state.h"
+
+using std::string;
+using std::vector;
+
+
+// Small pages, so lines get cut between them all the time
+static const size_t PAGE_SIZE = 4096;
+
+// Hands out data a page at a time, like a pipe would
+class StringSource : public InputSource {
+public:
+	explicit StringSource(std::string_view data) : data(data) {}
+
+	bool Fetch(string &page) override
+	{
+		if (data.empty())
+			return false;
+		size_t n = std::min(data.size(), PAGE_SIZE);
+		page.append(data.data(), n);
+		data.remove_prefix(n);
+		return true;
+	}
+
+private:
+	std::string_view data;
+};
+
+// Thrown by a path that doesn't apply to the listing
+struct not_applicable {};
+
+// What a path prunes, as offsets of lines in the listing or, if it doesn't have those, names
+struct decisions {
+	vector<uint64_t> offsets;
+	vector<string> names;
+};
+
+template <typename F>
+static path_result Run(char const* name, bool ordered, std::string_view data, char delim, F&& f)
+{
+	path_result r;
+	r.name = name;
+	r.ordered = ordered;
+	auto begin = std::chrono::steady_clock::now();
+	decisions d;
+	try {
+		d = f();
+	}
+	catch (not_applicable const&) {
+		return r;
+	}
+	catch (std::exception const& e) {
+		r.ran = true;
+		r.error = e.what();
+		return r;
+	}
+	r.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+	r.ran = true;
+	r.pruned = std::move(d.names);
+	for (uint64_t offset : d.offsets) {
+		size_t end = std::min(data.find(delim, offset), data.size());
+		r.pruned.emplace_back(data.substr(offset, end - offset));
+	}
+	return r;
+}
+
+// The entries of times (most recent first) that keep doesn't have
+static decisions Unkept(vector<keyentry> const& times, Bitmap const& keep)
+{
+	decisions d;
+	for (size_t i = 0; i < times.size(); i++) {
+		if (!keep.Test(i))
+			d.offsets.push_back(times[i].offset);
+	}
+	return d;
+}
+
+static decisions Retain(vector<keyentry> const& times, vector<keeptier> const& tiers)
+{
+	Bitmap keep(times.size());
+	FindPruneKeep(times, tiers, keep);
+	return Unkept(times, keep);
+}
+
+static vector<std::string_view> Lines(std::string_view data, char delim)
+{
+	vector<std::string_view> lines;
+	ForEachLine(data, delim, [&lines](std::string_view line) { lines.push_back(line); });
+	return lines;
+}
+
+static string Join(vector<std::string_view>::const_iterator begin,
+		vector<std::string_view>::const_iterator end, char delim)
+{
+	string data;
+	for (auto it = begin; it != end; ++it) {
+		data.append(*it);
+		data += delim;
+	}
+	return data;
+}
+
+// The names that the entries of times (most recent first, offsets into data) keep doesn't have
+static void AddUnkept(vector<keyentry> const& times, Bitmap const& keep, std::string_view data,
+		size_t name_len, vector<string> &names)
+{
+	for (size_t i = 0; i < times.size(); i++) {
+		if (!keep.Test(i))
+			names.emplace_back(data.substr(times[i].offset, name_len));
+	}
+}
+
+/* A second spec for the batch path, whose names are mixed in with the case's. Its literal
+ * prefix can't come out of the generator, and it goes first, so its names all end up in a group
+ * of their own however they parse under the case's spec.
+ */
+static const char BATCH_SPEC[] = "~b-{now:epoch}";
+static const size_t BATCH_NAMES = 500;
+
+static string BatchListing(char delim)
+{
+	string data;
+	char name[32];
+	for (size_t i = 0; i < BATCH_NAMES; i++) {
+		std::snprintf(name, sizeof(name), "~b-%010lld", (long long)(1600000000 - i * 3607));
+		data += name;
+		data += delim;
+	}
+	return data;
+}
+
+static vector<keeptier> BatchTiers()
+{
+	vector<keeptier> tiers(3);
+	tiers[0].bucket.unit = BUCKET_HOUR;
+	tiers[0].keep = 10;
+	tiers[1].bucket.unit = BUCKET_DAY;
+	tiers[1].keep = 7;
+	tiers[2].bucket.unit = BUCKET_WEEK;
+	tiers[2].keep = 3;
+	return tiers;
+}
+
+// Removes the state file it names, which doesn't exist to begin with
+class TempState {
+public:
+	TempState()
+	{
+		char const* dir = getenv("TMPDIR");
+		path = string(dir && *dir ? dir : "/tmp") + "/filetimegen_diff.XXXXXX";
+		int fd = mkstemp(&path[0]);
+		if (fd < 0)
+			throw std::runtime_error("failed to create a temporary file");
+		close(fd);
+		unlink(path.c_str());
+	}
+	~TempState() { unlink(path.c_str()); }
+
+	string path;
+};
+
+vector<path_result> RunPaths(diff_case const& c, size_t jobs)
+{
+	CompiledSpec spec(c.spec);
+	LineParser parser(spec);
+	std::ostream discard(nullptr);
+	std::string_view data = c.data;
+	char delim = c.delim;
+	vector<path_result> results;
+
+	string batch_data = BatchListing(delim);
+	vector<keeptier> batch_tiers = BatchTiers();
+	vector<string> batch_expected;
+	for (uint64_t offset : ReferencePrune(BATCH_SPEC, batch_data, delim, batch_tiers)) {
+		size_t end = batch_data.find(delim, offset);
+		batch_expected.push_back(batch_data.substr(offset, end - offset));
+	}
+	std::sort(batch_expected.begin(), batch_expected.end());
+
+	results.push_back(Run("reference", true, data, delim, [&]() {
+		return decisions{ ReferencePrune(c.spec, data, delim, c.tiers), {} };
+	}));
+	results.push_back(Run("sorted", true, data, delim, [&]() {
+		return Retain(ParseListing(parser, data, delim, 1, discard), c.tiers);
+	}));
+	results.push_back(Run("parallel", true, data, delim, [&]() {
+		return Retain(ParseListing(parser, data, delim, jobs, discard), c.tiers);
+	}));
+	// One line at a time through the scalar parser, and a comparison sort instead of the radix one
+	results.push_back(Run("scalar", true, data, delim, [&]() {
+		vector<keyentry> times;
+		ForEachLine(data, delim, [&](std::string_view line) {
+			timekey key;
+			if (parser.Parse(line, key, discard))
+				times.push_back(keyentry{ key, uint64_t(line.data() - data.data()) });
+		});
+		std::stable_sort(times.begin(), times.end(),
+				[](keyentry const& l, keyentry const& r) { return l.key > r.key; });
+		return Retain(times, c.tiers);
+	}));
+	results.push_back(Run("paged", true, data, delim, [&]() {
+		StringSource source(data);
+		string paged;
+		vector<keyentry> times = ParsePagedListing(parser, source, delim, true, paged, discard);
+		if (paged != data)
+			throw std::logic_error("paged listing doesn't match the input");
+		return Retain(times, c.tiers);
+	}));
+	results.push_back(Run("kept-entries", true, data, delim, [&]() {
+		vector<keyentry> times = ParseListing(parser, data, delim, 1, discard);
+		vector<size_t> kept = FindKeptEntries(times, c.tiers);
+		decisions d;
+		size_t k = 0;
+		for (size_t i = 0; i < times.size(); i++) {
+			if (k < kept.size() && kept[k] == i)
+				k++;
+			else
+				d.offsets.push_back(times[i].offset);
+		}
+		return d;
+	}));
+	results.push_back(Run("top-k", false, data, delim, [&]() {
+		vector<keyentry> times = ParseListingUnsorted(parser, data, delim, jobs, discard);
+		Bitmap keep(times.size());
+		FindPruneKeepUnsorted(times, c.tiers, keep);
+		return Unkept(times, keep);
+	}));
+	results.push_back(Run("library", false, data, delim, [&]() {
+		vector<std::string_view> names = Lines(data, delim);
+		// It turns down tiers that keep 0, which every other path treats as keeping 1
+		vector<keeptier> tiers = c.tiers;
+		bool zero = false;
+		for (keeptier &t : tiers) {
+			zero |= t.keep == 0;
+			t.keep = std::max<size_t>(t.keep, 1);
+		}
+		if (zero) {
+			try {
+				FindPruneNames(spec, c.tiers, names.data(), names.size());
+				throw std::logic_error("FindPruneNames took a tier that keeps 0");
+			}
+			catch (std::invalid_argument const&) {
+			}
+		}
+		decisions d;
+		for (size_t i : FindPruneNames(spec, tiers, names.data(), names.size()))
+			d.offsets.push_back(names[i].data() - data.data());
+		return d;
+	}));
+	results.push_back(Run("streaming", false, data, delim, [&]() {
+		decisions d;
+		StreamingPruner pruner(c.tiers, [&d](std::string_view name) {
+			d.names.emplace_back(name);
+		});
+		try {
+			ForEachLine(data, delim, [&](std::string_view line) {
+				timekey key;
+				if (parser.Parse(line, key, discard))
+					pruner.Add(key, line);
+			});
+		}
+		catch (std::runtime_error const&) {
+			// Out of order, it only takes sorted listings
+			throw not_applicable();
+		}
+		return d;
+	}));
+	results.push_back(Run("batch", false, data, delim, [&]() {
+		vector<std::string_view> lines = Lines(data, delim);
+		vector<std::string_view> others = Lines(batch_data, delim);
+		string mixed;
+		for (size_t i = 0, j = 0; i < lines.size() || j < others.size(); ) {
+			if (i < lines.size() && (j >= others.size() || i % 3 != 0))
+				mixed.append(lines[i++]);
+			else
+				mixed.append(others[j++]);
+			mixed += delim;
+		}
+		vector<CompiledSpec> compiled;
+		compiled.emplace_back(BATCH_SPEC);
+		compiled.emplace_back(c.spec);
+		SpecSet specs(std::move(compiled));
+		vector<vector<keyentry>> groups = ParseBatchListing(specs, mixed, delim, discard);
+		vector<Bitmap> keep = FindBatchKeep(groups, { batch_tiers, c.tiers }, jobs);
+
+		decisions d;
+		AddUnkept(groups[0], keep[0], mixed, specs[0].NameLength(), d.names);
+		std::sort(d.names.begin(), d.names.end());
+		if (d.names != batch_expected)
+			throw std::logic_error("the second spec of the batch doesn't prune what it should");
+		d.names.clear();
+		AddUnkept(groups[1], keep[1], mixed, spec.NameLength(), d.names);
+		return d;
+	}));
+	// Two runs over the older and the newer half of the listing, the second from the first's state
+	results.push_back(Run("state", false, data, delim, [&]() {
+		vector<std::string_view> lines = Lines(data, delim);
+		std::unordered_set<std::string_view> distinct;
+		for (std::string_view line : lines) {
+			timekey key;
+			// A name that's already known is taken to be the same entry
+			if (parser.Parse(line, key, discard) && !distinct.insert(line).second)
+				throw not_applicable();
+		}
+
+		size_t name_len = spec.NameLength();
+		TempState temp;
+		std::unordered_set<std::string_view> removed;
+		decisions d;
+		auto half = lines.begin() + lines.size() / 2;
+		string runs[2] = { Join(lines.begin(), half, delim), Join(half, lines.end(), delim) };
+		for (string const& run : runs) {
+			RetentionState state(temp.path, c.spec, name_len);
+			string names;
+			vector<keyentry> times = MergeRetentionState(state,
+					ParseListing(parser, run, delim, 1, discard), run, removed, names);
+			Bitmap keep(times.size());
+			FindPruneKeep(times, c.tiers, keep);
+			AddUnkept(times, keep, names, name_len, d.names);
+			WriteRetentionState(temp.path, c.spec, name_len, times, keep, names);
+		}
+		return d;
+	}));
+	return results;
+}
+
+string FindMismatch(vector<path_result> const& results)
+{
+	if (!results[0].error.empty())
+		return string("reference failed: ") + results[0].error;
+	vector<string> expected = results[0].pruned;
+	vector<string> expected_set = expected;
+	std::sort(expected_set.begin(), expected_set.end());
+	for (size_t i = 1; i < results.size(); i++) {
+		path_result const& r = results[i];
+		if (!r.ran)
+			continue;
+		if (!r.error.empty())
+			return string(r.name) + " failed: " + r.error;
+		vector<string> got = r.pruned;
+		vector<string> const* want = &expected;
+		if (!r.ordered) {
+			std::sort(got.begin(), got.end());
+			want = &expected_set;
+		}
+		if (got == *want)
+			continue;
+
+		std::ostringstream s;
+		s << r.name << " prunes " << got.size() << " entries, the reference " << want->size();
+		auto diff = std::mismatch(got.begin(), got.end(), want->begin(), want->end());
+		if (diff.first != got.end())
+			s << ", first difference '" << *diff.first << "'";
+		if (diff.second != want->end())
+			s << " where the reference has '" << *diff.second << "'";
+		return s.str();
+	}
+	return string();
+}
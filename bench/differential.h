@@ -0,0 +1,53 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+/* Differential checks for the --prune pipeline. The same listing is run through the reference
+ * (see reference.h) and through each of the faster paths filetimegen can take, and their prune
+ * decisions have to agree exactly. Used by filetimegen_diff and the fuzz target.
+ */
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "../retention.h"
+
+
+struct diff_case {
+	std::string spec;
+	std::string data;
+	char delim;
+	std::vector<keeptier> tiers;
+};
+
+/* What one path decided. Paths that put the listing out most recent first are compared in
+ * order, the others as sets. A path that doesn't apply (streaming, over an unsorted listing)
+ * hasn't run, one that threw has error set.
+ */
+struct path_result {
+	char const* name;
+	bool ran = false;
+	bool ordered = false;
+	std::vector<std::string> pruned;
+	std::string error;
+	double seconds = 0;
+};
+
+// Runs c through the reference, which is the first result, and then every other path.
+std::vector<path_result> RunPaths(diff_case const& c, size_t jobs);
+
+// Describes the first path that disagrees with the reference, empty if they all agree.
+std::string FindMismatch(std::vector<path_result> const& results);
@@ -0,0 +1,62 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+/* libFuzzer target: the bytes after a short header are a --prune listing, which every path has to
+ * prune the same way as the reference (see differential.h). Built with -DFILETIMEGEN_FUZZ=ON.
+ *
+ *   byte 0     bits 0-2 spec, bit 3 '\n' instead of '\0' as delimiter, bits 4-6 number of tiers
+ *   2 bytes    per tier: unit, then how many to keep (and the width of a BUCKET_MINUTES tier),
+ *              0 included
+ */
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "differential.h"
+
+
+static char const* const SPECS[] = {
+	"home-{now}", "{now}", "a{now}b{now}c", "{now}.x", "{now:iso-ms}", "{now:iso-z}",
+	"x{now:iso-offset}", "{now:epoch}b{now:epoch-ms}",
+};
+static const size_t SPEC_COUNT = sizeof(SPECS) / sizeof(SPECS[0]);
+
+extern "C" int LLVMFuzzerTestOneInput(uint8_t const* bytes, size_t size)
+{
+	if (size < 1)
+		return 0;
+	diff_case c;
+	c.spec = SPECS[(bytes[0] & 7) % SPEC_COUNT];
+	c.delim = bytes[0] & 8 ? '\n' : '\0';
+	size_t tiers = (bytes[0] >> 4) & 7;
+	size_t pos = 1;
+	for (size_t i = 0; i < tiers && pos + 2 <= size; i++, pos += 2) {
+		keeptier tier;
+		tier.bucket.unit = bucketunit(bytes[pos] % (BUCKET_MINUTES + 1));
+		tier.keep = bytes[pos + 1] % 64;
+		tier.bucket.width = tier.bucket.unit == BUCKET_MINUTES ? bytes[pos + 1] + 1 : 0;
+		c.tiers.push_back(tier);
+	}
+	c.data.assign(reinterpret_cast<char const*>(bytes) + pos, size - pos);
+
+	std::string mismatch = FindMismatch(RunPaths(c, 2));
+	if (!mismatch.empty()) {
+		std::fprintf(stderr, "%s\n", mismatch.c_str());
+		std::abort();
+	}
+	return 0;
+}
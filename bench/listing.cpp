@@ -0,0 +1,64 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "listing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+#include "../spec.h"
+#include "../timestruct.h"
+
+using std::string;
+using std::vector;
+using std::chrono::system_clock;
+
+
+string GenerateListing(listing_options const& opts)
+{
+	CompiledSpec spec(opts.spec);
+	std::mt19937_64 rng(opts.seed);
+	std::uniform_real_distribution<double> coin(0.0, 1.0);
+	std::uniform_int_distribution<int64_t> jitter(-opts.jitter, opts.jitter);
+
+	// Start far enough back that the newest entry is still in the past
+	int64_t newest = system_clock::to_time_t(system_clock::now());
+	vector<string> names;
+	names.reserve(opts.size);
+	for (size_t i = 0; i < opts.size; i++) {
+		int64_t t = newest - int64_t(i) * opts.interval + (opts.jitter ? jitter(rng) : 0);
+		string name = spec.Format(timestruct(system_clock::from_time_t(t)));
+		if (coin(rng) < opts.invalid) {
+			if (coin(rng) < 0.5)
+				name = "x" + name; // doesn't match the spec
+			else {
+				// A space in the middle of the {now} breaks every format
+				std::string_view now = spec.Now(name);
+				name[now.data() - name.data() + now.size() / 2] = ' ';
+			}
+		}
+		names.push_back(std::move(name));
+	}
+	if (opts.shuffle)
+		std::shuffle(names.begin(), names.end(), rng);
+
+	string out;
+	for (string const& name : names) {
+		out += name;
+		out += opts.delim;
+	}
+	return out;
+}
@@ -0,0 +1,39 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+
+/* Shape of a synthetic --prune listing. The defaults look like a minutely snapshot job that has
+ * been running for a couple of months.
+ */
+struct listing_options {
+	size_t size = 100000;           // number of lines
+	int64_t interval = 60;          // seconds between consecutive entries
+	int64_t jitter = 0;             // each entry is moved by up to this many seconds either way
+	double invalid = 0.01;          // fraction of lines that are rejected
+	std::string spec = "home-{now}";
+	bool shuffle = true;            // otherwise most recent first, like a sorted listing
+	char delim = '\0';
+	unsigned seed = 1;
+};
+
+/* Builds the listing, one delimited name per line. Half of the invalid lines don't match the
+ * spec, the other half match it but have a malformed {now}.
+ */
+std::string GenerateListing(listing_options const& opts);
@@ -0,0 +1,244 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "reference.h"
+
+#include <algorithm>
+#include <ctime>
+#include <regex>
+#include <stdexcept>
+
+using std::string;
+using std::vector;
+
+
+// "2020-01-12T13:45:00"
+static const size_t ISO_LENGTH = 19;
+// "2020-01-12T13:45:00.250"
+static const size_t ISO_MS_LENGTH = ISO_LENGTH + 4;
+
+/* The {now:fmt} formats, each with a pattern of its own. The iso ones are captured as
+ * year, month, day, hour, minute, second, then whatever comes after: milliseconds, or the
+ * sign, hours and minutes of an offset.
+ */
+enum refkind { REF_WALL, REF_WALL_MS, REF_UTC, REF_OFFSET, REF_EPOCH, REF_EPOCH_MS };
+
+struct refformat {
+	char const* name;
+	size_t width;
+	refkind kind;
+};
+
+static const refformat REF_FORMATS[] = {
+	{ "iso",        ISO_LENGTH,     REF_WALL },
+	{ "iso-ms",     ISO_MS_LENGTH,  REF_WALL_MS },
+	{ "iso-z",      ISO_LENGTH + 1, REF_UTC },
+	{ "iso-offset", ISO_LENGTH + 6, REF_OFFSET },
+	{ "epoch",      10,             REF_EPOCH },
+	{ "epoch-ms",   13,             REF_EPOCH_MS },
+};
+
+struct refslot {
+	size_t pos;
+	size_t length;
+	refformat const* format;
+};
+
+static vector<refslot> FindSlots(string const& spec)
+{
+	vector<refslot> slots;
+	for (size_t pos = 0; (pos = spec.find("{now", pos)) != string::npos; pos++) {
+		size_t end = spec.find('}', pos);
+		if (end == string::npos)
+			break;
+		string name = "iso";
+		if (spec[pos + 4] == ':')
+			name = spec.substr(pos + 5, end - pos - 5);
+		else if (spec[pos + 4] != '}')
+			continue;
+		refformat const* format = nullptr;
+		for (refformat const& f : REF_FORMATS) {
+			if (name == f.name)
+				format = &f;
+		}
+		if (!format)
+			throw std::invalid_argument("the reference doesn't know {now:" + name + "}");
+		slots.push_back(refslot{ pos, end + 1 - pos, format });
+	}
+	return slots;
+}
+
+// The original ValidateInputSpec, true if line doesn't match
+static bool Mismatch(string const& spec, string const& line, vector<refslot> const& slots)
+{
+	size_t now_i = 0;
+	size_t spec_i = 0;
+	size_t line_i = 0;
+	while (spec_i < spec.size() && line_i < line.size()) {
+		if (now_i < slots.size() && slots[now_i].pos == spec_i) {
+			spec_i += slots[now_i].length;
+			line_i += slots[now_i].format->width;
+			now_i++;
+		}
+		else if (spec[spec_i] != line[line_i])
+			return true;
+		else {
+			spec_i++;
+			line_i++;
+		}
+	}
+	return now_i != slots.size() || spec_i != spec.size() || line_i != line.size();
+}
+
+/* Milliseconds since 1970-01-01 of the time in value: the wall clock time for iso and iso-ms,
+ * the UTC instant for the others. timegm() normalizes out of range fields the way mktime() did
+ * for the original, without a timezone getting in the way, and an offset is then taken off.
+ */
+static bool ParseNow(string const& value, refformat const& format, int64_t &ms)
+{
+	static const std::regex isore(
+			R"HERE((\d{4})-(\d{2})-(\d{2})T(\d{2}):(\d{2}):(\d{2})(.*))HERE");
+	static const std::regex msre(R"HERE(\.(\d{3}))HERE");
+	static const std::regex offsetre(R"HERE(([+-])(\d{2}):(\d{2}))HERE");
+	static const std::regex epochre(R"HERE(\d+)HERE");
+
+	if (format.kind == REF_EPOCH || format.kind == REF_EPOCH_MS) {
+		if (!std::regex_match(value, epochre))
+			return false;
+		ms = std::stoll(value) * (format.kind == REF_EPOCH ? 1000 : 1);
+		return true;
+	}
+
+	std::smatch sm;
+	if (!std::regex_match(value.cbegin(), value.cend(), sm, isore))
+		return false;
+	std::tm tm = {};
+	tm.tm_year = std::stoi(sm[1]) - 1900;
+	tm.tm_mon = std::stoi(sm[2]) - 1;
+	tm.tm_mday = std::stoi(sm[3]);
+	tm.tm_hour = std::stoi(sm[4]);
+	tm.tm_min = std::stoi(sm[5]);
+	tm.tm_sec = std::stoi(sm[6]);
+	ms = int64_t(timegm(&tm)) * 1000;
+
+	string rest = sm[7];
+	std::smatch rm;
+	switch (format.kind) {
+	case REF_WALL:
+		return rest.empty();
+	case REF_WALL_MS:
+		if (!std::regex_match(rest.cbegin(), rest.cend(), rm, msre))
+			return false;
+		ms += std::stoi(rm[1]);
+		return true;
+	case REF_UTC:
+		return rest == "Z";
+	case REF_OFFSET: {
+		if (!std::regex_match(rest.cbegin(), rest.cend(), rm, offsetre))
+			return false;
+		int hh = std::stoi(rm[2]);
+		int mm = std::stoi(rm[3]);
+		if (hh >= 24 || mm >= 60)
+			return false;
+		int64_t offset = (hh * 60 + mm) * 60 * int64_t(1000);
+		ms -= rm[1] == "-" ? -offset : offset;
+		return true;
+	}
+	default:
+		return false;
+	}
+}
+
+static int64_t FloorDivide(int64_t a, int64_t b)
+{
+	return a / b - (a % b != 0 && (a < 0) != (b < 0));
+}
+
+static int64_t Bucket(int64_t wall, bucketing b)
+{
+	int64_t minutes = FloorDivide(wall, 60);
+	int64_t days = FloorDivide(wall, 86400);
+	time_t t = wall;
+	std::tm tm;
+	gmtime_r(&t, &tm);
+	int64_t year = int64_t(tm.tm_year) + 1900;
+	switch (b.unit) {
+	case BUCKET_MINUTE:
+		return minutes;
+	case BUCKET_HOUR:
+		return FloorDivide(wall, 3600);
+	case BUCKET_DAY:
+		return days;
+	case BUCKET_WEEK:
+		// Monday 1969-12-29
+		return FloorDivide(days + 3, 7);
+	case BUCKET_MONTH:
+		return year * 12 + tm.tm_mon;
+	case BUCKET_QUARTER:
+		return year * 4 + tm.tm_mon / 3;
+	case BUCKET_YEAR:
+		return year;
+	case BUCKET_MINUTES:
+		return FloorDivide(minutes, b.width);
+	}
+	return 0;
+}
+
+vector<uint64_t> ReferencePrune(string const& spec, std::string_view data, char delim,
+		vector<keeptier> const& tiers)
+{
+	vector<refslot> slots = FindSlots(spec);
+
+	struct entry {
+		int64_t ms;
+		uint64_t offset;
+	};
+	vector<entry> times;
+	for (size_t start = 0; start < data.size(); ) {
+		size_t end = std::min(data.find(delim, start), data.size());
+		string line(data.substr(start, end - start));
+		int64_t ms;
+		if (!Mismatch(spec, line, slots) && ParseNow(line.substr(slots[0].pos,
+				slots[0].format->width), *slots[0].format, ms))
+			times.push_back(entry{ ms, start });
+		start = end + 1;
+	}
+	std::stable_sort(times.begin(), times.end(),
+			[](entry const& l, entry const& r) { return l.ms > r.ms; });
+
+	vector<bool> keep(times.size());
+	if (!times.empty())
+		keep[0] = true;
+	for (keeptier const& tier : tiers) {
+		if (times.empty())
+			break;
+		int64_t current = Bucket(FloorDivide(times[0].ms, 1000), tier.bucket);
+		size_t kept = 1;
+		for (size_t i = 1; i < times.size() && kept < tier.keep; i++) {
+			int64_t b = Bucket(FloorDivide(times[i].ms, 1000), tier.bucket);
+			if (b == current)
+				continue;
+			current = b;
+			keep[i] = true;
+			kept++;
+		}
+	}
+
+	vector<uint64_t> pruned;
+	for (size_t i = 0; i < times.size(); i++) {
+		if (!keep[i])
+			pruned.push_back(times[i].offset);
+	}
+	return pruned;
+}
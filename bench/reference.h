@@ -0,0 +1,38 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../retention.h"
+
+
+/* --prune decided the way the original filetimegen did it: each line is checked against the spec
+ * character by character, its {now} is parsed with std::regex and normalized by libc, and every
+ * tier walks a stable sort of the times on its own. Apart from the tier types nothing is shared
+ * with the real pipeline, which is what makes it worth comparing against.
+ *
+ * A {now:fmt} value gets a pattern of its own and is checked and converted independently of the
+ * table in nowformat.cpp: iso and iso-ms are wall clock times, the rest UTC instants, iso-offset
+ * being timegm() minus its offset.
+ *
+ * Returns the offsets into data of the lines to prune, most recent first. Throws
+ * std::invalid_argument for a format it doesn't know.
+ */
+std::vector<uint64_t> ReferencePrune(std::string const& spec, std::string_view data, char delim,
+		std::vector<keeptier> const& tiers);
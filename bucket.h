@@ -0,0 +1,84 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+/* How a --keep tier groups times. Every timekey maps to a bucket ID, IDs never decrease as time
+ * goes on and two times share a bucket exactly when their IDs are equal, so retention only ever
+ * compares integers.
+ */
+
+#include <cstdint>
+
+#include "civil.h"
+#include "timekey.h"
+
+
+enum bucketunit {
+	BUCKET_MINUTE,
+	BUCKET_HOUR,
+	BUCKET_DAY,
+	BUCKET_WEEK,    // ISO 8601 weeks, Monday to Sunday, crossing year boundaries like any other
+	BUCKET_MONTH,
+	BUCKET_QUARTER,
+	BUCKET_YEAR,
+	BUCKET_MINUTES, // windows of width minutes, counted from 1970-01-01 00:00 local time
+};
+
+struct bucketing {
+	bucketunit unit;
+	int64_t width; // BUCKET_MINUTES only
+};
+
+// Days since 1970-01-01 of the date in key
+constexpr int64_t KeyDays(timekey key)
+{
+	return DaysFromCivil(int64_t(key >> KEY_YEAR_SHIFT) - KEY_YEAR_BIAS,
+			int((key & KEY_MON) >> KEY_MON_SHIFT), int((key & KEY_MDAY) >> KEY_MDAY_SHIFT));
+}
+
+constexpr int64_t BucketId(timekey key, bucketing b)
+{
+	switch (b.unit) {
+	// Fields are normalized and sorted by significance, so these are just the leading fields
+	case BUCKET_MINUTE:
+		return int64_t(key >> KEY_MIN_SHIFT);
+	case BUCKET_HOUR:
+		return int64_t(key >> KEY_HOUR_SHIFT);
+	case BUCKET_DAY:
+		return int64_t(key >> KEY_MDAY_SHIFT);
+	case BUCKET_MONTH:
+		return int64_t(key >> KEY_MON_SHIFT);
+	case BUCKET_YEAR:
+		return int64_t(key >> KEY_YEAR_SHIFT);
+	case BUCKET_QUARTER:
+		return int64_t(key >> KEY_YEAR_SHIFT) * 4
+			+ int64_t(((key & KEY_MON) >> KEY_MON_SHIFT) - 1) / 3;
+	case BUCKET_WEEK:
+		// 1970-01-01 was a Thursday, so Monday 1969-12-29 starts week 0
+		return FloorDiv(KeyDays(key) + 3, 7);
+	case BUCKET_MINUTES:
+		return FloorDiv(KeyDays(key) * 1440 + int64_t((key & KEY_HOUR) >> KEY_HOUR_SHIFT) * 60
+				+ int64_t((key & KEY_MIN) >> KEY_MIN_SHIFT), b.width);
+	}
+	return 0;
+}
+
+// Thursday 2020-12-31 and Sunday 2021-01-03 are in ISO week 2020-W53, Monday 2021-01-04 isn't.
+static_assert(BucketId(PackTime(DaysFromCivil(2020, 12, 31) * 86400), bucketing{ BUCKET_WEEK, 0 })
+		== BucketId(PackTime(DaysFromCivil(2021, 1, 3) * 86400 + 86399), bucketing{ BUCKET_WEEK, 0 }),
+		"ISO weeks cross the year");
+static_assert(BucketId(PackTime(DaysFromCivil(2021, 1, 4) * 86400), bucketing{ BUCKET_WEEK, 0 })
+		== BucketId(PackTime(DaysFromCivil(2021, 1, 3) * 86400), bucketing{ BUCKET_WEEK, 0 }) + 1,
+		"ISO weeks start on Monday");
@@ -0,0 +1,87 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+/* Proleptic Gregorian calendar arithmetic. These replace mktime/localtime for converting between
+ * calendar fields and a count of days since 1970-01-01, so no libc timezone state is involved.
+ * The algorithms are the ones described in Howard Hinnant's "chrono-Compatible Low-Level Date
+ * Algorithms".
+ */
+
+#include <cstdint>
+
+
+struct civil_date {
+	int64_t year;
+	int mon;  // month (1-12)
+	int mday; // day of the month (1-31)
+};
+
+// Division rounding towards negative infinity, so dates before the epoch work the same as after.
+constexpr int64_t FloorDiv(int64_t a, int64_t b)
+{
+	return (a >= 0 ? a : a - (b - 1)) / b;
+}
+
+constexpr int64_t FloorMod(int64_t a, int64_t b)
+{
+	return a - FloorDiv(a, b) * b;
+}
+
+// Days since 1970-01-01 of the given date. mon must be 1-12, mday may be out of range and simply
+// counts forward or backward from the first of the month.
+constexpr int64_t DaysFromCivil(int64_t year, int mon, int mday)
+{
+	year -= mon <= 2;
+	const int64_t era = FloorDiv(year, 400);
+	const int64_t yoe = year - era * 400;                                   // [0, 399]
+	const int64_t doy = (153 * (mon > 2 ? mon - 3 : mon + 9) + 2) / 5 + mday - 1;
+	const int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;              // [0, 146096]
+	return era * 146097 + doe - 719468;
+}
+
+constexpr civil_date CivilFromDays(int64_t days)
+{
+	days += 719468;
+	const int64_t era = FloorDiv(days, 146097);
+	const int64_t doe = days - era * 146097;                                // [0, 146096]
+	const int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365; // [0, 399]
+	const int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);            // [0, 365]
+	const int64_t mp = (5 * doy + 2) / 153;                                 // [0, 11]
+	const int mday = int(doy - (153 * mp + 2) / 5 + 1);
+	const int mon = int(mp < 10 ? mp + 3 : mp - 9);
+	return civil_date{ yoe + era * 400 + (mon <= 2), mon, mday };
+}
+
+// Like DaysFromCivil, but also accepts months outside 1-12 by carrying them into the year, the
+// same way mktime normalizes tm_mon.
+constexpr int64_t DaysFromCivilNorm(int64_t year, int mon, int mday)
+{
+	const int64_t m0 = mon - 1;
+	return DaysFromCivil(year + FloorDiv(m0, 12), int(FloorMod(m0, 12)) + 1, mday);
+}
+
+// Day of the year (0-365) for the given number of days since 1970-01-01.
+constexpr int YearDay(int64_t days)
+{
+	return int(days - DaysFromCivil(CivilFromDays(days).year, 1, 1));
+}
+
+static_assert(DaysFromCivil(1970, 1, 1) == 0, "epoch");
+static_assert(DaysFromCivil(2000, 3, 1) == 11017, "leap century");
+static_assert(CivilFromDays(-1).year == 1969 && CivilFromDays(-1).mday == 31, "before epoch");
+static_assert(DaysFromCivilNorm(2020, 13, 1) == DaysFromCivil(2021, 1, 1), "month carry");
+static_assert(DaysFromCivilNorm(2020, 0, 1) == DaysFromCivil(2019, 12, 1), "month borrow");
+static_assert(YearDay(DaysFromCivil(2020, 12, 31)) == 365, "leap year day");
@@ -0,0 +1,300 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "delete.h"
+
+#include <cerrno>
+#include <cstring>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/vfs.h>
+#if __has_include(<linux/btrfs.h>)
+#include <linux/btrfs.h>
+#include <linux/magic.h>
+#define HAVE_BTRFS 1
+#endif
+#endif
+
+#include "output.h"
+
+using std::string;
+
+
+// Queue this many names per worker before Add() starts waiting
+static const size_t QUEUE_PER_JOB = 64;
+// Unlinks in flight through io_uring at once
+static const unsigned URING_ENTRIES = 1024;
+
+Deleter::Deleter(int dirfd, size_t jobs, bool uring)
+	: dirfd(dirfd),
+	queue_limit(QUEUE_PER_JOB * (jobs ? jobs : 1)),
+	failures(0),
+	done(false)
+{
+	for (size_t i = 0; i < (jobs ? jobs : 1); i++)
+		workers.emplace_back(&Deleter::Work, this);
+	if (uring)
+		ring = UnlinkRing::Create(dirfd, URING_ENTRIES, [this](string const& name) { Queue(name); });
+}
+
+Deleter::~Deleter()
+{
+	Finish();
+}
+
+void Deleter::Add(std::string_view name)
+{
+	if (ring)
+		ring->Add(name);
+	else
+		Queue(name);
+}
+
+void Deleter::Queue(std::string_view name)
+{
+	std::unique_lock<std::mutex> guard(lock);
+	has_room.wait(guard, [this]() { return queue.size() < queue_limit; });
+	queue.emplace_back(name);
+	has_work.notify_one();
+}
+
+size_t Deleter::Finish()
+{
+	if (ring) {
+		ring->Finish();
+		ring.reset();
+	}
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		done = true;
+	}
+	has_work.notify_all();
+	for (std::thread &t : workers)
+		t.join();
+	workers.clear();
+	return failures;
+}
+
+void Deleter::Work()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	for (;;) {
+		has_work.wait(guard, [this]() { return done || !queue.empty(); });
+		if (queue.empty())
+			return;
+		string name = std::move(queue.front());
+		queue.pop_front();
+		has_room.notify_one();
+
+		guard.unlock();
+		int err = DeleteEntry(dirfd, name);
+		ReportDelete(name, err);
+		guard.lock();
+		if (err)
+			failures++;
+	}
+}
+
+CommandDeleter::CommandDeleter(string command, int dirfd, size_t batch, size_t jobs)
+	: command(std::move(command)),
+	dirfd(dirfd),
+	batch_size(batch ? batch : 1),
+	jobs(jobs ? jobs : 1),
+	failures(0)
+{
+}
+
+CommandDeleter::~CommandDeleter()
+{
+	Finish();
+}
+
+void CommandDeleter::Add(std::string_view name)
+{
+	batch.emplace_back(name);
+	if (batch.size() >= batch_size)
+		Launch();
+}
+
+void CommandDeleter::Launch()
+{
+	while (running.size() >= jobs)
+		Reap();
+
+	// sh -c 'command "$@"' sh names...
+	string script = command + " \"$@\"";
+	std::vector<char const*> argv = { "/bin/sh", "-c", script.c_str(), "sh" };
+	for (string const& name : batch)
+		argv.push_back(name.c_str());
+	argv.push_back(nullptr);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		if (dirfd != AT_FDCWD && fchdir(dirfd) != 0)
+			_exit(126);
+		execv("/bin/sh", const_cast<char **>(argv.data()));
+		_exit(127);
+	}
+	if (pid < 0) {
+		int err = errno;
+		for (string const& name : batch)
+			ReportDelete(name, err);
+		failures += batch.size();
+	}
+	else
+		running.emplace_back(pid, std::move(batch));
+	batch.clear();
+}
+
+void CommandDeleter::Reap()
+{
+	// Whichever has finished already, otherwise the oldest. Only our own children are waited for,
+	// there may be others.
+	int status = 0;
+	auto it = running.begin();
+	for (; it != running.end(); ++it) {
+		if (waitpid(it->first, &status, WNOHANG) == it->first)
+			break;
+	}
+	if (it == running.end()) {
+		it = running.begin();
+		pid_t pid;
+		do
+			pid = waitpid(it->first, &status, 0);
+		while (pid < 0 && errno == EINTR);
+		if (pid < 0)
+			status = -1;
+	}
+	if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+		for (string const& name : it->second)
+			ReportDelete(name, 0);
+	}
+	else {
+		string msg = "error: delete command failed for " + std::to_string(it->second.size())
+			+ " entries starting with '" + it->second.front() + "'\n";
+		try {
+			WriteAll(STDERR_FILENO, msg.data(), msg.size());
+		}
+		catch (...) {
+		}
+		failures += it->second.size();
+	}
+	running.erase(it);
+}
+
+size_t CommandDeleter::Finish()
+{
+	if (!batch.empty())
+		Launch();
+	while (!running.empty())
+		Reap();
+	return failures;
+}
+
+void ReportDelete(std::string_view name, int err)
+{
+	// One write per line, so lines from different workers never interleave.
+	string msg = err ? "error: failed to delete '" : "deleted: ";
+	msg.append(name.data(), name.size());
+	if (err) {
+		msg += "': ";
+		msg += std::strerror(err);
+	}
+	msg += "\n";
+	try {
+		WriteAll(STDERR_FILENO, msg.data(), msg.size());
+	}
+	catch (...) {
+		// Nowhere left to report to
+	}
+}
+
+#ifdef HAVE_BTRFS
+// The subvolume root directory always has this inode number
+static const ino_t BTRFS_SUBVOL_ROOT_INO = 256;
+
+static bool IsSubvolume(int fd, struct stat const& st)
+{
+	if (st.st_ino != BTRFS_SUBVOL_ROOT_INO)
+		return false;
+	struct statfs fs;
+	return fstatfs(fd, &fs) == 0 && fs.f_type == BTRFS_SUPER_MAGIC;
+}
+
+static int DestroySubvolume(int dirfd, string const& name)
+{
+	btrfs_ioctl_vol_args args;
+	std::memset(&args, 0, sizeof(args));
+	if (name.size() > BTRFS_PATH_NAME_MAX)
+		return ENAMETOOLONG;
+	std::memcpy(args.name, name.data(), name.size());
+	return ioctl(dirfd, BTRFS_IOC_SNAP_DESTROY, &args) == 0 ? 0 : errno;
+}
+#endif
+
+// Empties and removes the directory name in dirfd.
+static int RemoveTree(int dirfd, string const& name)
+{
+	int fd = openat(dirfd, name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0)
+		return errno;
+	DIR *dir = fdopendir(fd);
+	if (!dir) {
+		int err = errno;
+		close(fd);
+		return err;
+	}
+
+	int err = 0;
+	while (dirent *d = readdir(dir)) {
+		if (std::strcmp(d->d_name, ".") == 0 || std::strcmp(d->d_name, "..") == 0)
+			continue;
+		if (d->d_type == DT_DIR)
+			err = RemoveTree(fd, d->d_name);
+		else if (unlinkat(fd, d->d_name, 0) != 0)
+			err = errno == EISDIR ? RemoveTree(fd, d->d_name) : errno;
+		if (err)
+			break;
+	}
+	closedir(dir);
+	if (err)
+		return err;
+	return unlinkat(dirfd, name.c_str(), AT_REMOVEDIR) == 0 ? 0 : errno;
+}
+
+int DeleteEntry(int dirfd, string const& name)
+{
+	struct stat st;
+	if (fstatat(dirfd, name.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0)
+		return errno;
+	if (!S_ISDIR(st.st_mode))
+		return unlinkat(dirfd, name.c_str(), 0) == 0 ? 0 : errno;
+
+#ifdef HAVE_BTRFS
+	if (IsSubvolume(dirfd, st)) {
+		int err = DestroySubvolume(dirfd, name);
+		// Without user_subvol_rm_allowed only root may use the ioctl, but an empty
+		// subvolume can still be removed like a directory.
+		if (err != EPERM)
+			return err;
+	}
+#endif
+	return RemoveTree(dirfd, name);
+}
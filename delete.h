@@ -0,0 +1,119 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "uring.h"
+
+
+/* Where pruned entries go to be deleted.
+ */
+class EntryRemover {
+public:
+	virtual ~EntryRemover() =default;
+
+	// Queues name for deletion. May block while deletions are too far behind.
+	virtual void Add(std::string_view name) =0;
+	// Waits for everything queued so far. Returns how many deletions failed.
+	virtual size_t Finish() =0;
+};
+
+/* Deletes pruned entries relative to a directory with a bounded number of worker threads.
+ * Regular files (and anything else that isn't a directory) are unlinked, btrfs subvolumes are
+ * destroyed with BTRFS_IOC_SNAP_DESTROY and other directories are removed recursively. Each
+ * result is reported on stderr as it happens.
+ * With uring, names are first unlinked in batches through io_uring by the thread calling Add(),
+ * and only what that can't handle goes to the workers. Without io_uring support everything goes
+ * to the workers.
+ */
+class Deleter : public EntryRemover {
+public:
+	// dirfd is not closed, it has to stay open until Finish() returns.
+	Deleter(int dirfd, size_t jobs, bool uring = false);
+	~Deleter() override;
+
+	Deleter(Deleter const&) =delete;
+	Deleter& operator=(Deleter const&) =delete;
+
+	// Blocks while the workers are too far behind.
+	void Add(std::string_view name) override;
+	size_t Finish() override;
+
+private:
+	void Queue(std::string_view name);
+	void Work();
+
+	int dirfd;
+	std::unique_ptr<UnlinkRing> ring;
+	std::vector<std::thread> workers;
+	std::mutex lock;
+	std::condition_variable has_work;
+	std::condition_variable has_room;
+	std::deque<std::string> queue;
+	size_t queue_limit;
+	size_t failures;
+	bool done;
+};
+
+/* Deletes pruned entries by running command through /bin/sh with up to batch names as its
+ * arguments, like xargs, e.g. a tool that deletes up to 1000 keys from an object store per
+ * request. Up to jobs commands run at once, in the directory dirfd. A command that fails counts
+ * as a failure for all of its names.
+ */
+class CommandDeleter : public EntryRemover {
+public:
+	// dirfd is not closed, it has to stay open until Finish() returns.
+	CommandDeleter(std::string command, int dirfd, size_t batch, size_t jobs);
+	~CommandDeleter() override;
+
+	CommandDeleter(CommandDeleter const&) =delete;
+	CommandDeleter& operator=(CommandDeleter const&) =delete;
+
+	// Blocks while jobs commands are running already and the current batch is full.
+	void Add(std::string_view name) override;
+	size_t Finish() override;
+
+private:
+	void Launch();
+	void Reap();
+
+	std::string command;
+	int dirfd;
+	size_t batch_size;
+	size_t jobs;
+	std::vector<std::string> batch;
+	// Running commands and the names they were given
+	std::vector<std::pair<pid_t, std::vector<std::string>>> running;
+	size_t failures;
+};
+
+/* Deletes one entry the same way Deleter does, synchronously. Returns 0 or an errno value.
+ */
+int DeleteEntry(int dirfd, std::string const& name);
+
+// Reports the outcome of deleting name (err from DeleteEntry) on stderr.
+void ReportDelete(std::string_view name, int err);
@@ -0,0 +1,128 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "dirscan.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+using std::string;
+
+
+int OpenDirectory(string const& path)
+{
+	int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		throw std::system_error(errno, std::generic_category(),
+				"failed to open directory '" + path + "'");
+	}
+	return fd;
+}
+
+template <typename Match>
+static void AddName(string &out, std::string_view name, Match const& match, char delim)
+{
+	// A name with the delimiter in it couldn't be told apart from two names on output.
+	if (!match(name) || name.find(delim) != std::string_view::npos)
+		return;
+	out.append(name.data(), name.size());
+	out.push_back(delim);
+}
+
+#if defined(__linux__) && defined(SYS_getdents64)
+
+// Layout the kernel fills in for getdents64, glibc doesn't export it.
+struct linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+// Large enough that even huge snapshot directories only take a handful of system calls
+static const size_t DIRENT_BUFFER = 1 << 20;
+
+template <typename Match>
+static string Scan(int dirfd, Match const& match, char delim)
+{
+	string out;
+	std::vector<char> buf(DIRENT_BUFFER);
+	for (;;) {
+		long n = syscall(SYS_getdents64, dirfd, buf.data(), buf.size());
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			throw std::system_error(errno, std::generic_category(), "failed to read directory");
+		if (n == 0)
+			break;
+		for (long pos = 0; pos < n;) {
+			linux_dirent64 const* d = reinterpret_cast<linux_dirent64 const*>(buf.data() + pos);
+			AddName(out, d->d_name, match, delim);
+			pos += d->d_reclen;
+		}
+	}
+	return out;
+}
+
+#else
+
+template <typename Match>
+static string Scan(int dirfd, Match const& match, char delim)
+{
+	// fdopendir takes ownership, so give it its own descriptor
+	int fd = dup(dirfd);
+	DIR *dir = fd < 0 ? nullptr : fdopendir(fd);
+	if (!dir) {
+		if (fd >= 0)
+			close(fd);
+		throw std::system_error(errno, std::generic_category(), "failed to read directory");
+	}
+	string out;
+	errno = 0;
+	while (dirent *d = readdir(dir)) {
+		AddName(out, d->d_name, match, delim);
+		errno = 0;
+	}
+	int err = errno;
+	closedir(dir);
+	if (err)
+		throw std::system_error(err, std::generic_category(), "failed to read directory");
+	return out;
+}
+
+#endif
+
+string ScanDirectory(int dirfd, CompiledSpec const& spec, char delim)
+{
+	return Scan(dirfd, [&spec](std::string_view name) { return spec.Matches(name); }, delim);
+}
+
+string ScanDirectory(int dirfd, SpecSet const& specs, char delim)
+{
+	return Scan(dirfd, [&specs](std::string_view name) {
+		return specs.Find(name) != SpecSet::npos;
+	}, delim);
+}
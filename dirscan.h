@@ -0,0 +1,32 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <string>
+
+#include "spec.h"
+
+
+// Opens path as a directory for ScanDirectory. Throws std::system_error on failure.
+int OpenDirectory(std::string const& path);
+
+/* Lists the directory dirfd refers to, in the same format as a --prune list read from stdin:
+ * every name that matches spec followed by delim. Other entries (including "." and "..") are
+ * skipped without a warning, the same as find -name would. Only names are looked at, nothing is
+ * stat'ed. Throws std::system_error on failure.
+ */
+std::string ScanDirectory(int dirfd, CompiledSpec const& spec, char delim);
+// Same, keeping every name that matches any of specs
+std::string ScanDirectory(int dirfd, SpecSet const& specs, char delim);
@@ -0,0 +1,100 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "filetimegen.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "timekey.h"
+
+using std::vector;
+
+
+// Names are parsed this many at a time, so their {now} values can be converted together
+static const size_t NAME_BATCH = 256;
+
+/* Parses the names that match spec into entries whose offset is their index in names, in the
+ * same order. The indices of the others go to rejected, in order too.
+ */
+static vector<keyentry> ParseNames(CompiledSpec const& spec, std::string_view const* names,
+		size_t count, vector<size_t> *rejected)
+{
+	vector<keyentry> entries;
+	entries.reserve(count);
+	char const* nows[NAME_BATCH];
+	size_t index[NAME_BATCH];
+	timekey keys[NAME_BATCH];
+	bool valid[NAME_BATCH];
+	for (size_t start = 0; start < count; start += NAME_BATCH) {
+		size_t end = std::min(count, start + NAME_BATCH);
+		size_t now_count = 0;
+		size_t first_rejected = rejected ? rejected->size() : 0;
+		for (size_t i = start; i < end; i++) {
+			if (spec.Matches(names[i])) {
+				index[now_count] = i;
+				nows[now_count++] = spec.Now(names[i]).data();
+			}
+			else if (rejected)
+				rejected->push_back(i);
+		}
+		spec.NowFormat().parse(nows, now_count, keys, valid);
+		for (size_t n = 0; n < now_count; n++) {
+			if (valid[n])
+				entries.push_back(keyentry{ keys[n], index[n] });
+			else if (rejected)
+				rejected->push_back(index[n]);
+		}
+		if (rejected)
+			std::sort(rejected->begin() + first_rejected, rejected->end());
+	}
+	return entries;
+}
+
+// The same limit the --keep options have
+static void CheckTiers(vector<keeptier> const& tiers)
+{
+	for (keeptier const& t : tiers) {
+		if (t.keep < 1)
+			throw std::invalid_argument("every tier has to keep at least 1");
+	}
+}
+
+void FindKeepNames(CompiledSpec const& spec, vector<keeptier> const& tiers,
+		std::string_view const* names, size_t count, Bitmap &keep, vector<size_t> *rejected)
+{
+	CheckTiers(tiers);
+	vector<keyentry> entries = ParseNames(spec, names, count, rejected);
+	Bitmap entry_keep(entries.size());
+	FindPruneKeepUnsorted(entries, tiers, entry_keep);
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (entry_keep.Test(i))
+			keep.Set(entries[i].offset);
+	}
+}
+
+vector<size_t> FindPruneNames(CompiledSpec const& spec, vector<keeptier> const& tiers,
+		std::string_view const* names, size_t count, vector<size_t> *rejected)
+{
+	CheckTiers(tiers);
+	vector<keyentry> entries = ParseNames(spec, names, count, rejected);
+	Bitmap keep(entries.size());
+	FindPruneKeepUnsorted(entries, tiers, keep);
+	vector<size_t> prune;
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (!keep.Test(i))
+			prune.push_back(entries[i].offset);
+	}
+	return prune;
+}
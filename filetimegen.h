@@ -0,0 +1,48 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+/* The in-process interface of filetimegen_lib, for programs that would otherwise run filetimegen
+ * --prune for every set of names they rotate. Everything here is reentrant: calls share no
+ * mutable state, so any number of threads can make them at once, also with the same spec.
+ */
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "bucket.h"
+#include "prune.h"
+#include "retention.h"
+#include "spec.h"
+#include "timestruct.h"
+
+
+/* Marks the names that the tiers keep in keep, which has to hold count bits and is indexed like
+ * names. Names that don't match spec, or whose {now} isn't a valid time, are neither kept nor
+ * considered; their indices are appended to rejected if it's given. The names aren't copied and
+ * can be in any order, decisions are the same as filetimegen --prune would make. Throws
+ * std::invalid_argument if a tier keeps less than 1, which the --keep options don't allow either.
+ */
+void FindKeepNames(CompiledSpec const& spec, std::vector<keeptier> const& tiers,
+		std::string_view const* names, size_t count, Bitmap &keep,
+		std::vector<size_t> *rejected = nullptr);
+
+/* FindKeepNames(), returning the indices of the names to prune instead, in the order the names
+ * were given. Rejected names are never pruned.
+ */
+std::vector<size_t> FindPruneNames(CompiledSpec const& spec, std::vector<keeptier> const& tiers,
+		std::string_view const* names, size_t count, std::vector<size_t> *rejected = nullptr);
@@ -0,0 +1,176 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "input.h"
+
+#include <cerrno>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::string;
+
+
+// Pipes are read in pieces of this size.
+static const size_t READ_CHUNK = 1 << 16;
+
+static std::system_error ReadError(char const* name)
+{
+	return std::system_error(errno, std::generic_category(),
+			string("failed to read input '") + name + "'");
+}
+
+InputBuffer::InputBuffer(int fd)
+	: map(nullptr),
+	map_len(0)
+{
+	Load(fd, "<stdin>");
+}
+
+InputBuffer::InputBuffer(string const& path)
+	: map(nullptr),
+	map_len(0)
+{
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		throw ReadError(path.c_str());
+	try {
+		Load(fd, path.c_str());
+	}
+	catch (...) {
+		close(fd);
+		throw;
+	}
+	// The mapping stays valid after the descriptor is gone.
+	close(fd);
+}
+
+InputBuffer::~InputBuffer()
+{
+	if (map)
+		munmap(map, map_len);
+}
+
+void InputBuffer::Load(int fd, char const* name)
+{
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		// Respect the current offset, in case the caller already consumed part of stdin.
+		off_t start = lseek(fd, 0, SEEK_CUR);
+		if (start < 0)
+			start = 0;
+		if (st.st_size <= start)
+			return;
+
+		void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) {
+			map = p;
+			map_len = st.st_size;
+			madvise(map, map_len, MADV_SEQUENTIAL);
+			data = std::string_view(static_cast<char const*>(map) + start, map_len - start);
+			return;
+		}
+		// Fall through and read it like a pipe.
+	}
+
+	for (;;) {
+		size_t used = owned.size();
+		owned.resize(used + READ_CHUNK);
+		ssize_t n = read(fd, &owned[used], READ_CHUNK);
+		if (n < 0 && errno == EINTR) {
+			owned.resize(used);
+			continue;
+		}
+		if (n < 0)
+			throw ReadError(name);
+		owned.resize(used + n);
+		if (n == 0)
+			break;
+	}
+	data = owned;
+}
+
+
+LineReader::LineReader(int fd, char delim)
+	: fd(fd),
+	owns_fd(false),
+	delim(delim),
+	pos(0),
+	eof(false),
+	name("<stdin>")
+{
+}
+
+LineReader::LineReader(string const& path, char delim)
+	: fd(open(path.c_str(), O_RDONLY | O_CLOEXEC)),
+	owns_fd(true),
+	delim(delim),
+	pos(0),
+	eof(false),
+	name(path)
+{
+	if (fd < 0)
+		throw ReadError(path.c_str());
+}
+
+LineReader::~LineReader()
+{
+	if (owns_fd)
+		close(fd);
+}
+
+bool LineReader::Next(std::string_view &line)
+{
+	for (;;) {
+		size_t nl = buf.find(delim, pos);
+		if (nl != string::npos) {
+			line = std::string_view(buf.data() + pos, nl - pos);
+			pos = nl + 1;
+			return true;
+		}
+		if (eof) {
+			if (pos >= buf.size())
+				return false;
+			// Last line without a trailing delimiter
+			line = std::string_view(buf.data() + pos, buf.size() - pos);
+			pos = buf.size();
+			return true;
+		}
+		eof = !Fill();
+	}
+}
+
+bool LineReader::Fill()
+{
+	if (refill_hook)
+		refill_hook();
+
+	// Keep the partial line that is left, drop everything already handed out.
+	buf.erase(0, pos);
+	pos = 0;
+	for (;;) {
+		size_t used = buf.size();
+		buf.resize(used + READ_CHUNK);
+		ssize_t n = read(fd, &buf[used], READ_CHUNK);
+		buf.resize(used + (n > 0 ? n : 0));
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			throw ReadError(name.c_str());
+		return n > 0;
+	}
+}
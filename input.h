@@ -0,0 +1,101 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+
+
+/* The complete --prune listing held in memory. Regular files are memory mapped, anything else
+ * (pipes, terminals) is read into an owned buffer. Lines handed out by ForEachLine point straight
+ * into these bytes and stay valid for the lifetime of the InputBuffer.
+ */
+class InputBuffer {
+public:
+	// Takes the bytes from the current offset of fd onwards. fd is not closed.
+	explicit InputBuffer(int fd);
+	// Opens and maps path. Throws std::system_error if it can't be read.
+	explicit InputBuffer(std::string const& path);
+	~InputBuffer();
+
+	InputBuffer(InputBuffer const&) =delete;
+	InputBuffer& operator=(InputBuffer const&) =delete;
+
+	std::string_view Data() const { return data; }
+	// The bytes are a read-only mapping of a file, so they never change under an output pipe.
+	bool Mapped() const { return map != nullptr; }
+
+private:
+	void Load(int fd, char const* name);
+
+	std::string_view data;
+	void *map;
+	size_t map_len;
+	std::string owned;
+};
+
+/* Calls f(std::string_view) for each delim separated line in data. Behaves like repeated
+ * std::getline: a trailing delimiter does not produce an empty last line.
+ */
+template <typename F>
+void ForEachLine(std::string_view data, char delim, F&& f)
+{
+	char const* p = data.data();
+	char const* end = p + data.size();
+	while (p < end) {
+		char const* nl = static_cast<char const*>(std::memchr(p, delim, end - p));
+		if (!nl)
+			nl = end;
+		f(std::string_view(p, nl - p));
+		p = nl + 1;
+	}
+}
+
+/* Reads a listing incrementally, for when it shouldn't all be held in memory at once. Only the
+ * current chunk of input is buffered.
+ */
+class LineReader {
+public:
+	// Reads from fd, which is not closed.
+	LineReader(int fd, char delim);
+	// Opens path. Throws std::system_error if it can't be opened.
+	LineReader(std::string const& path, char delim);
+	~LineReader();
+
+	LineReader(LineReader const&) =delete;
+	LineReader& operator=(LineReader const&) =delete;
+
+	/* Hands out the next line, which stays valid until the next call. Returns false at the end of
+	 * input. Same line splitting rules as ForEachLine. Throws std::system_error on read errors.
+	 */
+	bool Next(std::string_view &line);
+
+	// Called every time Next() is about to block on read(2), e.g. to flush output first.
+	void OnRefill(std::function<void()> hook) { refill_hook = std::move(hook); }
+
+private:
+	bool Fill();
+
+	int fd;
+	bool owns_fd;
+	char delim;
+	std::string buf;
+	size_t pos;
+	bool eof;
+	std::string name;
+	std::function<void()> refill_hook;
+};
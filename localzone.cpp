@@ -0,0 +1,48 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "localzone.h"
+
+#include <algorithm>
+
+
+LocalZone::LocalZone()
+	: zone(ZoneTable::FromEnvironment())
+{
+}
+
+LocalZone const& LocalZone::Get()
+{
+	static const LocalZone zone;
+	return zone;
+}
+
+// Offsets never change twice within this long, and never by more than it
+static const int64_t ZONE_SEARCH_WINDOW = 86400;
+
+int64_t LocalZone::LocalToUtc(int64_t local) const
+{
+	// The offsets a day either side are the only ones local could have been shown with
+	int64_t before = zone.OffsetAt(local - ZONE_SEARCH_WINDOW);
+	int64_t after = zone.OffsetAt(local + ZONE_SEARCH_WINDOW);
+	int64_t utc_before = local - before;
+	int64_t utc_after = local - after;
+	bool fits_before = utc_before + zone.OffsetAt(utc_before) == local;
+	bool fits_after = utc_after + zone.OffsetAt(utc_after) == local;
+	if (fits_before && fits_after)
+		return std::min(utc_before, utc_after);
+	if (fits_after)
+		return utc_after;
+	return utc_before;
+}
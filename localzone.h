@@ -0,0 +1,44 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <cstdint>
+
+#include "tzfile.h"
+
+
+/* UTC offsets of the local timezone. The zone's transition table is loaded once, when the zone is
+ * first used, so converting timestamps afterwards is a binary search that is safe to do from
+ * several threads and never touches libc's timezone state.
+ */
+class LocalZone {
+public:
+	static LocalZone const& Get();
+
+	// Offset in seconds east of UTC at the given UTC time, including daylight savings time.
+	int64_t OffsetAt(int64_t utc) const { return zone.OffsetAt(utc); }
+
+	/* The UTC time that shows local (seconds since 1970-01-01 in local wall clock time). When
+	 * the clocks go back a wall clock time happens twice and the earlier of the two is used.
+	 * Times skipped when the clocks go forward are taken with the offset from before the jump,
+	 * so they land that far after it.
+	 */
+	int64_t LocalToUtc(int64_t local) const;
+
+private:
+	LocalZone();
+
+	ZoneTable zone;
+};
@@ -12,21 +12,44 @@
    See the License for the specific language governing permissions and
    limitations under the License.
 */
+#include <algorithm>
 #include <iostream>
 #include <cstdint>
 #include <chrono>
 #include <ctime>
 #include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <exception>
-#include <cstdio>
+#include <stdexcept>
+#include <unordered_set>
+#include <utility>
 #include <vector>
-#include <regex>
-#include <algorithm>
-#include <iterator>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "bucket.h"
+#include "delete.h"
+#include "dirscan.h"
+#include "input.h"
+#include "output.h"
+#include "prune.h"
+#include "retention.h"
+#include "source.h"
+#include "spec.h"
+#include "state.h"
+#include "stats.h"
+#include "timekey.h"
+#include "timestruct.h"
+#include "watch.h"
 
 const char *usage = R"HERE(
 usage: filetimegen <spec> [OPTIONS]
+       filetimegen --batch <config> [OPTIONS]
 
 BRIEF:
 Outputs a filename according to <spec>. Typically this is a prefix plus a time.
@@ -37,26 +60,127 @@ REQUIRED ARGUMENTS:
 <spec>           Specifies how the output should be named. Will replace any
                  instance of {now} with the current time. If spec does not
                  contain {now} anywhere, this command will fail.
+                 {now:fmt} picks the format, one of:
+                   iso         2020-01-12T13:45:00 (the default)
+                   iso-ms      2020-01-12T13:45:00.250
+                   iso-z       2020-01-12T12:45:00Z, in UTC
+                   iso-offset  2020-01-12T13:45:00+01:00
+                   epoch       1578833100, seconds since 1970 UTC
+                   epoch-ms    1578833100250
+                 The first {now} of a name is its time when pruning, in any
+                 format. iso and iso-ms are bucketed by local time, the
+                 others by UTC, so they keep their order when clocks go back.
 
 [OPTIONS]
     -h, --help   Print this message.
+    --utc        Generate the name from UTC instead of local time, without
+                 loading the time zone.
     --prune      Changes the mode of the command so that it expects a list of
                  files to be provided on stdin (null seperated). This will
                  output the list of files that should be deleted based on
                  --keep specifications.
     --newline    When printing and accepting input, use newlines instead of
                  null seperators.
+    --input <file>
+                 Read the --prune list from <file> instead of stdin. Regular
+                 files (including stdin redirected from one) are memory
+                 mapped rather than read.
+    --list-cmd <command>
+                 Read the --prune list from the output of <command>, run with
+                 /bin/sh, e.g. a tool listing an object store bucket. The list
+                 is parsed while it's still coming in. Not available with
+                 --prune-dir, --input, --presorted, --watch or --batch.
+    --prune-dir <dir>
+                 Implies --prune. Reads the names in <dir> instead of a list
+                 on stdin. Names that don't match <spec> are skipped silently.
+                 Output names are relative to <dir>.
+    --watch <dir>
+                 Implies --prune. Like --prune-dir, but keeps running: after
+                 the first listing, new arrivals in <dir> are picked up with
+                 inotify and whatever they push out is pruned right away. Runs
+                 until SIGINT, SIGTERM or SIGHUP.
+    --batch <config>
+                 Implies --prune. Prunes several specs from one listing instead
+                 of taking <spec>. Every line of <config> is a spec followed by
+                 its --keep options, e.g. "home-{now} -H 8 -d 7". Blank lines
+                 and lines starting with # are skipped. Each name belongs to
+                 the first spec that matches it. Specs are pruned in parallel
+                 with --jobs. Not available with --presorted, --state or
+                 --watch.
+    --simulate <policies>
+                 Implies --prune. Instead of pruning, report how many entries
+                 each keep policy in <policies> would keep and prune. Every line
+                 of <policies> is a set of --keep options, e.g. "-H 24 -d 7";
+                 blank lines and lines starting with # are skipped. Policies
+                 after the first are also compared with the first one. The
+                 --prune list is only parsed and sorted once. Not available
+                 with --delete, --presorted, --state, --watch or --batch.
+    --presorted  The --prune list is already sorted by time, either most
+                 recent first or oldest first. It is processed as it is read
+                 instead of being held in memory, and names are output as soon
+                 as they are known to be pruned. Fails if the input turns out
+                 not to be sorted.
+    --unordered-output
+                 Output (or delete) the pruned names in the order they were
+                 read, instead of most recent first. The --prune list then
+                 doesn't need sorting: what to keep is picked out in a single
+                 pass. Not available with --presorted, --state, --watch or
+                 --batch.
+    --vmsplice   When stdout is a pipe and the --prune list is a memory mapped
+                 file (--input, or stdin redirected from one), hand the pruned
+                 names to the pipe with vmsplice(2) instead of copying them.
+    --delete     Delete the pruned entries instead of printing them. Files are
+                 unlinked, btrfs subvolumes are destroyed and directories are
+                 removed recursively. Each result is reported on stderr. Names
+                 are relative to --prune-dir, or the current directory.
+    --delete-jobs <N>
+                 Delete up to N entries at a time (default 4).
+    --delete-cmd <command>
+                 Implies --delete. Delete by running <command> with /bin/sh,
+                 with up to 1000 pruned names as its arguments, like xargs.
+                 Up to --delete-jobs commands run at once. A command that
+                 fails counts as failing to delete all of its names.
+    --delete-uring
+                 Implies --delete. Unlink files in large io_uring batches
+                 instead of one syscall each. Directories and subvolumes still
+                 go through --delete-jobs workers. Falls back to plain --delete
+                 where io_uring isn't available.
+    --state <file>
+                 Remember the entries that were kept in <file>, so the next run
+                 only needs the names that are new since. Whatever is pruned
+                 is forgotten, so it should actually be deleted. Created if it
+                 doesn't exist. Not available with --presorted.
+    --removed <file>
+                 With --state, names (same separator as the input) that have
+                 disappeared since the state was written.
+    --stats      After --prune, print how long each phase took and how many
+                 lines were read, rejected, kept (per tier) and pruned, plus
+                 the peak memory use, on stderr. Not available with
+                 --presorted, --watch or --batch.
+    --stats-json Like --stats, as a single line of JSON.
+    -j, --jobs <N>
+                 Parse and sort the --prune list with up to N threads. Warnings
+                 are still printed in input order. Ignored with --presorted.
+                 Without -j, a list coming from a pipe is parsed while it is
+                 being read; with it, the pipe is read to the end first.
     -M, --keep-minutely
     -H, --keep-hourly
     -d, --keep-daily
     -w, --keep-weekly
     -m, --keep-monthly
+    -q, --keep-quarterly
+    -y, --keep-yearly
                  Specifiers for how many files should be kept. Only used during
-                 --prune operation.
+                 --prune operation. Weeks are ISO 8601 weeks, starting on
+                 Monday.
+    --keep-every <width> <N>
+                 Keep one file for each of the newest N windows of <width>,
+                 given in minutes (15m, or just 15), hours (6h) or days (2d).
+                 Windows are counted from 1970-01-01 00:00 local time. May be
+                 given more than once.
 )HERE";
 
 
-using std::shared_ptr;
 using std::string;
 using std::cout;
 using std::vector;
@@ -66,19 +190,44 @@ using std::chrono::system_clock;
 class CLArgs {
 public:
 	string Spec;
-	shared_ptr<int> KeepMinutely;
-	shared_ptr<int> KeepHourly;
-	shared_ptr<int> KeepDaily;
-	shared_ptr<int> KeepWeekly;
-	shared_ptr<int> KeepMonthly;
+	std::optional<int> KeepMinutely;
+	std::optional<int> KeepHourly;
+	std::optional<int> KeepDaily;
+	std::optional<int> KeepWeekly;
+	std::optional<int> KeepMonthly;
+	std::optional<int> KeepQuarterly;
+	std::optional<int> KeepYearly;
+	// --keep-every: window width in minutes, and how many to keep
+	vector<std::pair<int, int>> KeepEvery;
+	string Input;
+	string PruneDir;
+	string Watch;
+	string State;
+	string Removed;
+	string Batch;
+	string ListCmd;
+	string DeleteCmd;
+	string Simulate;
 	bool Newline;
+	bool Utc;
 	bool Prune;
+	bool Presorted;
+	bool Delete;
+	bool DeleteUring;
+	bool Stats;
+	bool Vmsplice;
+	bool UnorderedOutput;
+	bool StatsJson;
+	int Jobs;
+	int DeleteJobs;
 
 	CLArgs() =default;
 	CLArgs(int argc, char **argv);
 
 private:
 	int ParseCLInt(int &i, int argc, char **argv);
+	string ParseCLString(int &i, int argc, char **argv);
+	int ParseCLWidth(int &i, int argc, char **argv);
 	void ValidateArgs();
 };
 
@@ -104,15 +253,61 @@ int CLArgs::ParseCLInt(int &i, int argc, char **argv)
 	}
 }
 
+/* i is pointing at the current option, need to increment before parsing.
+ */
+string CLArgs::ParseCLString(int &i, int argc, char **argv)
+{
+	string errstring = string("option '") + argv[i] + "' requires an argument";
+	i++;
+	if (i >= argc)
+		throw std::invalid_argument(errstring);
+	return argv[i];
+}
+
+/* i is pointing at the current option, need to increment before parsing. Returns minutes.
+ */
+int CLArgs::ParseCLWidth(int &i, int argc, char **argv)
+{
+	string errstring = string("option '") + argv[i] + "' requires a width like 15m, 6h or 2d";
+	string width = ParseCLString(i, argc, argv);
+	size_t used = 0;
+	int value;
+	try {
+		value = std::stoi(width, &used);
+	}
+	catch (...) {
+		throw std::invalid_argument(errstring);
+	}
+	string unit = width.substr(used);
+	int scale = unit.empty() || unit == "m" ? 1 : unit == "h" ? 60 : unit == "d" ? 1440 : 0;
+	if (!scale || value < 1 || value > INT32_MAX / scale)
+		throw std::invalid_argument(errstring);
+	return value * scale;
+}
+
 CLArgs::CLArgs(int argc, char **argv)
 	: Spec(""),
-	KeepMinutely(nullptr),
-	KeepHourly(nullptr),
-	KeepDaily(nullptr),
-	KeepWeekly(nullptr),
-	KeepMonthly(nullptr),
+	Input(""),
+	PruneDir(""),
+	Watch(""),
+	State(""),
+	Removed(""),
+	Batch(""),
+	ListCmd(""),
+	DeleteCmd(""),
+	Simulate(""),
 	Newline(false),
-	Prune(false)
+	Utc(false),
+	Prune(false),
+	Presorted(false),
+	Delete(false),
+	DeleteUring(false),
+	Stats(false),
+	Vmsplice(false),
+	UnorderedOutput(false),
+	StatsJson(false),
+	Jobs(1),
+	DeleteJobs(4)
 {
 	size_t posargs = 0;
 	for (int i = 1; i < argc; i++) {
@@ -123,18 +318,80 @@ CLArgs::CLArgs(int argc, char **argv)
 		}
 		else if (streq(arg, "--newline"))
 			Newline = true;
+		else if (streq(arg, "--utc"))
+			Utc = true;
 		else if (streq(arg, "--prune"))
 			Prune = true;
+		else if (streq(arg, "--presorted"))
+			Presorted = true;
+		else if (streq(arg, "--delete"))
+			Delete = true;
+		else if (streq(arg, "--delete-jobs"))
+			DeleteJobs = ParseCLInt(i, argc, argv);
+		else if (streq(arg, "--delete-uring")) {
+			Delete = true;
+			DeleteUring = true;
+		}
+		else if (streq(arg, "--stats"))
+			Stats = true;
+		else if (streq(arg, "--stats-json")) {
+			Stats = true;
+			StatsJson = true;
+		}
+		else if (streq(arg, "--unordered-output"))
+			UnorderedOutput = true;
+		else if (streq(arg, "--vmsplice"))
+			Vmsplice = true;
+		else if (streq(arg, "--list-cmd")) {
+			ListCmd = ParseCLString(i, argc, argv);
+			Prune = true;
+		}
+		else if (streq(arg, "--simulate")) {
+			Simulate = ParseCLString(i, argc, argv);
+			Prune = true;
+		}
+		else if (streq(arg, "--delete-cmd")) {
+			DeleteCmd = ParseCLString(i, argc, argv);
+			Delete = true;
+		}
+		else if (streq(arg, "--input"))
+			Input = ParseCLString(i, argc, argv);
+		else if (streq(arg, "--state"))
+			State = ParseCLString(i, argc, argv);
+		else if (streq(arg, "--batch")) {
+			Batch = ParseCLString(i, argc, argv);
+			Prune = true;
+		}
+		else if (streq(arg, "--removed"))
+			Removed = ParseCLString(i, argc, argv);
+		else if (streq(arg, "--watch")) {
+			Watch = ParseCLString(i, argc, argv);
+			Prune = true;
+		}
+		else if (streq(arg, "--prune-dir")) {
+			PruneDir = ParseCLString(i, argc, argv);
+			Prune = true;
+		}
+		else if (streq(arg, "-j") || streq(arg, "--jobs"))
+			Jobs = ParseCLInt(i, argc, argv);
 		else if (streq(arg, "-M") || streq(arg, "--keep-minutely"))
-			KeepMinutely = std::make_shared<int>(ParseCLInt(i, argc, argv));
+			KeepMinutely = ParseCLInt(i, argc, argv);
 		else if (streq(arg, "-H") || streq(arg, "--keep-hourly"))
-			KeepHourly = std::make_shared<int>(ParseCLInt(i, argc, argv));
+			KeepHourly = ParseCLInt(i, argc, argv);
 		else if (streq(arg, "-d") || streq(arg, "--keep-daily"))
-			KeepDaily = std::make_shared<int>(ParseCLInt(i, argc, argv));
+			KeepDaily = ParseCLInt(i, argc, argv);
 		else if (streq(arg, "-w") || streq(arg, "--keep-weekly"))
-			KeepWeekly = std::make_shared<int>(ParseCLInt(i, argc, argv));
+			KeepWeekly = ParseCLInt(i, argc, argv);
 		else if (streq(arg, "-m") || streq(arg, "--keep-monthly"))
-			KeepMonthly = std::make_shared<int>(ParseCLInt(i, argc, argv));
+			KeepMonthly = ParseCLInt(i, argc, argv);
+		else if (streq(arg, "-q") || streq(arg, "--keep-quarterly"))
+			KeepQuarterly = ParseCLInt(i, argc, argv);
+		else if (streq(arg, "-y") || streq(arg, "--keep-yearly"))
+			KeepYearly = ParseCLInt(i, argc, argv);
+		else if (streq(arg, "--keep-every")) {
+			int width = ParseCLWidth(i, argc, argv);
+			KeepEvery.emplace_back(width, ParseCLInt(i, argc, argv));
+		}
 		else if (posargs == 0) {
 			Spec = arg;
 			posargs++;
@@ -152,257 +409,515 @@ void CLArgs::ValidateArgs()
 			|| (KeepDaily && *KeepDaily < 1)
 			|| (KeepWeekly && *KeepWeekly < 1)
 			|| (KeepMonthly && *KeepMonthly < 1)
+			|| (KeepQuarterly && *KeepQuarterly < 1)
+			|| (KeepYearly && *KeepYearly < 1)
+			|| std::any_of(KeepEvery.begin(), KeepEvery.end(),
+				[](std::pair<int, int> const& every) { return every.second < 1; })
 			)
 	{
 		throw std::invalid_argument("All --keep arguments must be >= 1");
 	}
-	if (Spec.find("{now}") == string::npos)
+	if (Jobs < 1)
+		throw std::invalid_argument("--jobs must be >= 1");
+	if (DeleteJobs < 1)
+		throw std::invalid_argument("--delete-jobs must be >= 1");
+	if (Delete && !Prune)
+		throw std::invalid_argument("--delete requires --prune or --prune-dir");
+	if (!PruneDir.empty() && !Input.empty())
+		throw std::invalid_argument("--prune-dir and --input can't be used together");
+	if (!ListCmd.empty() && (!PruneDir.empty() || !Input.empty() || Presorted || !Watch.empty() || !Batch.empty()))
+		throw std::invalid_argument("--list-cmd can't be used with --prune-dir, --input, --presorted, --watch or --batch");
+	if (!Simulate.empty() && (Delete || Presorted || !State.empty() || !Watch.empty() || !Batch.empty()))
+		throw std::invalid_argument("--simulate can't be used with --delete, --presorted, --state, --watch or --batch");
+	if (!DeleteCmd.empty() && DeleteUring)
+		throw std::invalid_argument("--delete-cmd and --delete-uring can't be used together");
+	if (!PruneDir.empty() && Presorted)
+		throw std::invalid_argument("directory listings are never sorted, drop --presorted");
+	if (!Watch.empty() && (!PruneDir.empty() || !Input.empty() || Presorted || !State.empty()))
+		throw std::invalid_argument("--watch can't be used with --prune-dir, --input, --presorted or --state");
+	if (!State.empty() && Presorted)
+		throw std::invalid_argument("--state can't be used with --presorted");
+	if (!Removed.empty() && State.empty())
+		throw std::invalid_argument("--removed requires --state");
+	if (Stats && (!Prune || Presorted || !Watch.empty() || !Batch.empty()))
+		throw std::invalid_argument("--stats only works with --prune, without --presorted, --watch or --batch");
+	if (UnorderedOutput && (!Prune || Presorted || !State.empty() || !Watch.empty() || !Batch.empty()))
+		throw std::invalid_argument("--unordered-output only works with --prune, without --presorted, --state, --watch or --batch");
+	if (!Batch.empty()) {
+		if (!Spec.empty())
+			throw std::invalid_argument("<spec> comes from the --batch config, don't give one");
+		if (Presorted || !State.empty() || !Watch.empty())
+			throw std::invalid_argument("--batch can't be used with --presorted, --state or --watch");
+		return;
+	}
+	// Compiling it also rejects an unknown {now:fmt}
+	if (CompiledSpec(Spec).NowCount() == 0)
 		throw std::invalid_argument("<spec> must contain {now} somewhere");
 }
 
 
-/* Time comparison mask values. Specifies what needs to be checked when comparing time values
- */
-enum timecomp : uint64_t {
-	MINUTES   = 1 << 1,
-	HOURS     = 1 << 2,
-	MONTHDAYS = 1 << 3,
-	MONTHS    = 1 << 4,
-	YEARS     = 1 << 5,
-	WEEKS     = 1 << 6,
-
-	COMP_YEARLY = YEARS,
-	COMP_MONTHLY = COMP_YEARLY | MONTHS,
-	COMP_DAILY = COMP_MONTHLY | MONTHDAYS,
-	COMP_HOURLY = COMP_DAILY | HOURS,
-	COMP_MINUTELY = COMP_HOURLY | MINUTES,
-	// Weeks can't be defined in the same cascading fashion.
-	COMP_WEEKLY = YEARS | WEEKS,
+// The --keep-* options that were given, in the form the retention engine wants them
+vector<keeptier> KeepTiers(CLArgs const& clargs)
+{
+	vector<keeptier> tiers;
+	auto add = [&tiers](std::optional<int> const& keep_amt, bucketunit unit) {
+		if (keep_amt)
+			tiers.push_back(keeptier{ size_t(*keep_amt), bucketing{ unit, 0 } });
+	};
+	add(clargs.KeepMinutely, BUCKET_MINUTE);
+	add(clargs.KeepHourly, BUCKET_HOUR);
+	add(clargs.KeepDaily, BUCKET_DAY);
+	add(clargs.KeepWeekly, BUCKET_WEEK);
+	add(clargs.KeepMonthly, BUCKET_MONTH);
+	add(clargs.KeepQuarterly, BUCKET_QUARTER);
+	add(clargs.KeepYearly, BUCKET_YEAR);
+	for (std::pair<int, int> const& every : clargs.KeepEvery)
+		tiers.push_back(keeptier{ size_t(every.second), bucketing{ BUCKET_MINUTES, every.first } });
+	return tiers;
+}
+
+// Closes a directory opened for --prune-dir, if there is one
+struct DirGuard {
+	int fd = AT_FDCWD;
+	~DirGuard() { if (fd >= 0) close(fd); }
 };
 
-struct timestruct {
-	int sec;  // seconds after the minute (0-60)
-	int min;  // minutes after the hour (0-59)
-	int hour; // hours since midnight (0-23)
-	int mday; // day of the month (1-31)
-	int mon;  // month (1-12)
-	int year; // year
-	int yday; // day of year (0-365)
-	int week; // week of year (0-52)
+// Waits for the deleter and turns failures into an error, after every entry has been tried
+void FinishDelete(EntryRemover &deleter)
+{
+	size_t failures = deleter.Finish();
+	if (failures)
+		throw std::runtime_error("failed to delete " + std::to_string(failures) + " entries");
+}
+
+// Names per --delete-cmd command, as many as an S3 style bulk delete takes
+const size_t DELETE_CMD_BATCH = 1000;
+
+// What --delete or --delete-cmd deletes with, names relative to dirfd
+std::unique_ptr<EntryRemover> MakeDeleter(CLArgs const& clargs, int dirfd)
+{
+	if (!clargs.DeleteCmd.empty())
+		return std::make_unique<CommandDeleter>(clargs.DeleteCmd, dirfd, DELETE_CMD_BATCH,
+				clargs.DeleteJobs);
+	return std::make_unique<Deleter>(dirfd, clargs.DeleteJobs, clargs.DeleteUring);
+}
+
+// Whether fd is a pipe or anything else that can only be read as it comes
+bool IsStream(int fd)
+{
+	struct stat st;
+	return fstat(fd, &st) == 0 && !S_ISREG(st.st_mode);
+}
 
-	system_clock::time_point tp;
+// The --prune list, from --prune-dir, --list-cmd, --input or stdin
+class Listing {
+public:
+	// Specs is a CompiledSpec or SpecSet, only names it matches are taken from --prune-dir.
+	template <typename Specs>
+	Listing(CLArgs const& clargs, Specs const& specs, char delim)
+		: delim(delim)
+	{
+		if (!clargs.PruneDir.empty()) {
+			dir.fd = OpenDirectory(clargs.PruneDir);
+			scanned = ScanDirectory(dir.fd, specs, delim);
+			data = scanned;
+		}
+		else if (!clargs.ListCmd.empty())
+			source = std::make_unique<CommandSource>(clargs.ListCmd);
+		else if (clargs.Input.empty() && clargs.Jobs == 1 && IsStream(STDIN_FILENO))
+			source = std::make_unique<FdSource>(STDIN_FILENO);
+		else {
+			if (clargs.Input.empty())
+				input = std::make_unique<InputBuffer>(STDIN_FILENO);
+			else
+				input = std::make_unique<InputBuffer>(clargs.Input);
+			data = input->Data();
+		}
+	}
 
-	timestruct(system_clock::time_point time_point);
-	timestruct(string const& intime);
+	/* Parses the listing, most recent first with sorted. A listing that comes in pages is parsed
+	 * while the rest is still being fetched.
+	 */
+	vector<keyentry> Parse(LineParser const& parser, size_t jobs, bool sorted, parsestats *stats)
+	{
+		if (source) {
+			vector<keyentry> entries = ParsePagedListing(parser, *source, delim, sorted, scanned,
+					std::cerr, stats);
+			source.reset();
+			data = scanned;
+			return entries;
+		}
+		if (sorted)
+			return ParseListing(parser, data, delim, jobs, std::cerr, stats);
+		return ParseListingUnsorted(parser, data, delim, jobs, std::cerr, stats);
+	}
 
-	bool EqlMask(timestruct const& rhs, uint64_t mask);
+	// The whole listing, fetched first if Parse() hasn't done that already
+	std::string_view Data()
+	{
+		if (source) {
+			while (source->Fetch(scanned))
+				;
+			source.reset();
+			data = scanned;
+		}
+		return data;
+	}
+	// Data() is a read-only file mapping, see OutputBuffer::UseVmsplice()
+	bool Mapped() const { return input && input->Mapped(); }
+	// What names are relative to
+	int DirFd() const { return dir.fd; }
+
+private:
+	// Held open until the end so --delete works on the directory that was listed
+	DirGuard dir;
+	char delim;
+	string scanned;
+	std::unique_ptr<InputBuffer> input;
+	std::unique_ptr<InputSource> source;
+	std::string_view data;
 };
 
-/* NOTE: struct tm has a few unique properties, such as tm_year being defined as "years since 1900".
- * These are noted in the constructor below.
+void PruneSortedFiles(CLArgs const& clargs, CompiledSpec const& spec)
+{
+	LineParser parser(spec);
+	char delim = clargs.Newline ? '\n' : '\0';
+	std::unique_ptr<LineReader> reader;
+	if (clargs.Input.empty())
+		reader = std::make_unique<LineReader>(STDIN_FILENO, delim);
+	else
+		reader = std::make_unique<LineReader>(clargs.Input, delim);
+
+	OutputBuffer out(STDOUT_FILENO);
+	// Whatever is decided gets passed on before waiting for more input
+	reader->OnRefill([&out]() { out.Flush(); });
+
+	std::unique_ptr<EntryRemover> deleter;
+	if (clargs.Delete)
+		deleter = MakeDeleter(clargs, AT_FDCWD);
+
+	StreamingPruner pruner(KeepTiers(clargs), [&out, &deleter, delim](std::string_view name) {
+		if (deleter)
+			deleter->Add(name);
+		else {
+			out.Append(name);
+			out.Append(delim);
+		}
+	});
+	std::string_view line;
+	while (reader->Next(line)) {
+		timekey key;
+		if (parser.Parse(line, key))
+			pruner.Add(key, line);
+	}
+	out.Flush();
+	if (deleter)
+		FinishDelete(*deleter);
+}
+
+void WatchFiles(CLArgs const& clargs, CompiledSpec const& spec)
+{
+	// Before the deleter starts its threads
+	sigset_t stop = BlockStopSignals();
+
+	char delim = clargs.Newline ? '\n' : '\0';
+	DirGuard dir;
+	dir.fd = OpenDirectory(clargs.Watch);
+
+	OutputBuffer out(STDOUT_FILENO);
+	std::unique_ptr<EntryRemover> deleter;
+	if (clargs.Delete)
+		deleter = MakeDeleter(clargs, dir.fd);
+
+	WatchDirectory(dir.fd, clargs.Watch, spec, delim, KeepTiers(clargs), stop,
+			[&out, &deleter, delim](std::string_view name) {
+				if (deleter)
+					deleter->Add(name);
+				else {
+					out.Append(name);
+					out.Append(delim);
+				}
+			},
+			[&out]() { out.Flush(); });
+	out.Flush();
+	if (deleter)
+		FinishDelete(*deleter);
+}
+
+/* Loads the --state file and --removed list and merges the state with the new entries from data.
+ * The names of the result are copied to names, which is what its offsets point into.
  */
-timestruct::timestruct(system_clock::time_point time_point)
-	: tp(time_point)
+vector<keyentry> MergeState(CLArgs const& clargs, size_t name_len, char delim,
+		vector<keyentry> const& fresh, std::string_view data, string &names)
 {
-	std::time_t now_tt = system_clock::to_time_t(tp);
-	tm *tm_time = localtime(&now_tt);
-
-	sec = tm_time->tm_sec;
-	min = tm_time->tm_min;
-	hour = tm_time->tm_hour;
-	mday = tm_time->tm_mday;
-	mon = tm_time->tm_mon + 1; // tm_mon is months since January (0-11)
-	year = tm_time->tm_year + 1900; // tm_year is years since 1900
-	yday = tm_time->tm_yday; // tm_yday is days since January 1 (0-365)
-	week = tm_time->tm_yday / 7; // Not the ISO 8601 weekly calendar, but it's good enough for backups
+	RetentionState state(clargs.State, clargs.Spec, name_len);
+
+	std::unique_ptr<InputBuffer> removed_list;
+	std::unordered_set<std::string_view> removed;
+	if (!clargs.Removed.empty()) {
+		removed_list = std::make_unique<InputBuffer>(clargs.Removed);
+		ForEachLine(removed_list->Data(), delim, [&removed](std::string_view name) {
+			removed.insert(name);
+		});
+	}
+	return MergeRetentionState(state, fresh, data, removed, names);
 }
 
-timestruct::timestruct(string const& intime)
+void PruneFiles(CLArgs const& clargs, CompiledSpec const& spec)
 {
-	// Regex to extract the date fields
-	std::regex nowre(R"HERE((\d{4})-(\d{2})-(\d{2})T(\d{2}):(\d{2}):(\d{2}))HERE");
-	std::smatch sm;
-	if (!std::regex_match(intime.cbegin(), intime.cend(), sm, nowre))
-		throw std::invalid_argument("{now} is not the correct time format");
-	try {
-		// the first match is the entire regex match, subsequent values are capture groups. C++ std.
-		year = std::stoi(sm[1]);
-		mon = std::stoi(sm[2]);
-		mday = std::stoi(sm[3]);
-		hour = std::stoi(sm[4]);
-		min = std::stoi(sm[5]);
-		sec = std::stoi(sm[6]);
+	RunStats stats(clargs.Stats);
+	LineParser parser(spec);
+	size_t name_len = spec.NameLength();
+
+	char delim = clargs.Newline ? '\n' : '\0';
+	Listing listing(clargs, spec, delim);
+	stats.Lap("read");
+
+	vector<keyentry> input_times = listing.Parse(parser, clargs.Jobs, !clargs.UnorderedOutput,
+			&stats.parse);
+	std::string_view data = listing.Data();
+	stats.Lap("parse");
+	string state_names;
+	if (!clargs.State.empty()) {
+		input_times = MergeState(clargs, name_len, delim, input_times, data, state_names);
+		data = state_names;
+		stats.Lap("state");
 	}
-	catch (...) {
-		throw std::invalid_argument("failed to convert to valid time");
+
+	// Figure out what to keep based on input
+	vector<keeptier> tiers = KeepTiers(clargs);
+	Bitmap keep(input_times.size());
+	if (clargs.UnorderedOutput)
+		FindPruneKeepUnsorted(input_times, tiers, keep);
+	else
+		FindPruneKeep(input_times, tiers, keep);
+	stats.Lap("retention");
+	if (stats.Enabled()) {
+		stats.CountTiers(input_times, tiers);
+		for (size_t i = 0; i < input_times.size(); i++)
+			stats.kept += keep.Test(i);
+		stats.pruned = input_times.size() - stats.kept;
+	}
+	// Before anything is pruned, so an interrupted run sees the pruned entries as new next time
+	if (!clargs.State.empty()) {
+		WriteRetentionState(clargs.State, clargs.Spec, name_len, input_times, keep, data);
+		stats.Lap("write-state");
+	}
+	if (input_times.empty()) {
+		stats.Report(std::cerr, clargs.StatsJson);
+		return;
+	}
+
+	if (clargs.Delete) {
+		std::unique_ptr<EntryRemover> deleter = MakeDeleter(clargs, listing.DirFd());
+		for (size_t i = 0; i < input_times.size(); i++) {
+			if (!keep.Test(i))
+				deleter->Add(data.substr(input_times[i].offset, name_len));
+		}
+		FinishDelete(*deleter);
+		stats.Lap("delete");
+		stats.Report(std::cerr, clargs.StatsJson);
+		return;
 	}
 
-	// Convert fields to get a valid time_point. This is an inverse of the operations in the other
-	// constructor.
-	tm timeinfo;
-	timeinfo.tm_sec = sec;
-	timeinfo.tm_min = min;
-	timeinfo.tm_hour = hour;
-	timeinfo.tm_mday = mday;
-	timeinfo.tm_mon = mon - 1;
-	timeinfo.tm_year = year - 1900;
-	// We will assume not daylight savings time. This is a bug, but ISO 8601 doesn't have a good way
-	// to show DST in the timespec.
-	timeinfo.tm_isdst = 0;
-	std::time_t tt = mktime(&timeinfo);
-	tp = system_clock::from_time_t(tt);
-	// Fill in these fields after calling mktime
-	yday = timeinfo.tm_yday;
-	week = timeinfo.tm_yday / 7;
+	// Output what should be pruned
+	OutputBuffer out(STDOUT_FILENO);
+	if (clargs.Vmsplice && clargs.State.empty() && listing.Mapped())
+		out.UseVmsplice();
+	WritePruned(input_times, keep, data, name_len, delim, out);
+	out.Flush();
+	stats.Lap("output");
+	stats.Report(std::cerr, clargs.StatsJson);
 }
 
-// Mask is actually a selection mask, so if the bit is set that comparison will matter
-bool timestruct::EqlMask(timestruct const& rhs, uint64_t mask)
+// How many values the --keep option arg takes, 0 if it isn't one
+size_t KeepOptionValues(string const& arg)
 {
-	bool retval = true;
-	if (mask & MINUTES)
-		retval = retval && (min == rhs.min);
-	if (mask & HOURS)
-		retval = retval && (hour == rhs.hour);
-	if (mask & MONTHDAYS)
-		retval = retval && (mday == rhs.mday);
-	if (mask & MONTHS)
-		retval = retval && (mon == rhs.mon);
-	if (mask & YEARS)
-		retval = retval && (year == rhs.year);
-	if (mask & WEEKS)
-		retval = retval && (week == rhs.week);
-	return retval;
+	for (char const* opt : { "-M", "--keep-minutely", "-H", "--keep-hourly", "-d", "--keep-daily",
+			"-w", "--keep-weekly", "-m", "--keep-monthly", "-q", "--keep-quarterly",
+			"-y", "--keep-yearly" }) {
+		if (streq(arg, opt))
+			return 1;
+	}
+	return streq(arg, "--keep-every") ? 2 : 0;
 }
 
-bool SortTimestruct(timestruct const& lhs, timestruct const& rhs)
+/* Calls f(tokens, where) for every line of the config file path that isn't blank or a comment,
+ * with the line split on whitespace and where naming the line for error messages.
+ */
+template <typename F>
+void ForEachConfigLine(string const& path, F&& f)
 {
-	return lhs.tp < rhs.tp;
+	InputBuffer config(path);
+	size_t lineno = 0;
+	ForEachLine(config.Data(), '\n', [&](std::string_view line) {
+		lineno++;
+		vector<string> tokens;
+		size_t pos = 0;
+		while ((pos = line.find_first_not_of(" \t\r", pos)) != std::string_view::npos) {
+			size_t end = std::min(line.find_first_of(" \t\r", pos), line.size());
+			tokens.emplace_back(line.substr(pos, end - pos));
+			pos = end;
+		}
+		if (tokens.empty() || tokens[0][0] == '#')
+			return;
+		f(tokens, path + ":" + std::to_string(lineno) + ": ");
+	});
 }
 
-// length of "2020-01-12T13:45:00"
-const size_t NOW_SPEC_LENGTH = 19;
+// Parses tokens like a command line, naming the config line where on errors
+CLArgs ParseConfigArgs(vector<string> tokens, string const& where)
+{
+	vector<char *> argv;
+	for (string &token : tokens)
+		argv.push_back(&token[0]);
+	try {
+		return CLArgs(int(argv.size()), argv.data());
+	}
+	catch (std::invalid_argument const& e) {
+		throw std::invalid_argument(where + e.what());
+	}
+}
 
-string GenerateFileTime(string Spec, timestruct now)
+/* Reads the --batch config. Every line is parsed like a command line that only has a spec and
+ * --keep options. Throws std::invalid_argument naming the line that is wrong.
+ */
+vector<CLArgs> ReadBatchConfig(string const& path)
 {
-	char now_str[100];
-	std::snprintf(now_str, 100, "%04d-%02d-%02dT%02d:%02d:%02d",
-			now.year, now.mon, now.mday,
-			now.hour, now.min, now.sec
-			);
-
-	size_t pos;
-	while ((pos = Spec.find("{now}")) != string::npos)
-		Spec.replace(pos, 5, now_str);
-	return Spec;
+	vector<CLArgs> specs;
+	ForEachConfigLine(path, [&specs](vector<string> tokens, string const& where) {
+		for (size_t i = 1; i < tokens.size(); i += 1 + KeepOptionValues(tokens[i])) {
+			if (!KeepOptionValues(tokens[i]))
+				throw std::invalid_argument(where + "only --keep options can follow the spec");
+		}
+		tokens.insert(tokens.begin(), "filetimegen");
+		specs.push_back(ParseConfigArgs(tokens, where));
+	});
+	if (specs.empty())
+		throw std::invalid_argument(path + ": no specs in --batch config");
+	return specs;
 }
 
+// A --simulate policy, and how it reads in the policy file
+struct policy {
+	string text;
+	vector<keeptier> tiers;
+};
 
-bool ValidateInputSpec(string const& Spec, string const& line, vector<size_t> const& nowpos)
+/* Reads the --simulate policies, each line parsed like the --keep options of a command line.
+ * Throws std::invalid_argument naming the line that is wrong.
+ */
+vector<policy> ReadPolicies(CLArgs const& clargs)
 {
-	size_t now_i = 0;
-	size_t spec_i = 0;
-	size_t line_i = 0;
-	while (spec_i < Spec.size() && line_i < line.size()) {
-		if (now_i < nowpos.size() && nowpos[now_i] == spec_i) {
-			// Reached a {now} in the spec. Just verify character length.
-			now_i += 1;
-			spec_i += 5; // length of "{now}"
-			line_i += NOW_SPEC_LENGTH; // length of "2020-01-12T13:45:00"
-		}
-		else if (Spec[spec_i] != line[line_i]) {
-			// Constant characters in the spec do not match
-			return true;
+	vector<policy> policies;
+	ForEachConfigLine(clargs.Simulate, [&](vector<string> tokens, string const& where) {
+		string text;
+		for (size_t i = 0; i < tokens.size(); i += 1 + KeepOptionValues(tokens[i])) {
+			if (!KeepOptionValues(tokens[i]))
+				throw std::invalid_argument(where + "policies can only have --keep options");
 		}
-		else {
-			// Constant character matches, just increment positions
-			spec_i++;
-			line_i++;
-		}
-	}
-	if (now_i != nowpos.size() || spec_i != Spec.size() || line_i != line.size()) {
-		return true;
-	}
-	return false;
+		for (string const& token : tokens)
+			text += (text.empty() ? "" : " ") + token;
+		tokens.insert(tokens.begin(), { "filetimegen", clargs.Spec });
+		policies.push_back(policy{ text, KeepTiers(ParseConfigArgs(tokens, where)) });
+	});
+	if (policies.empty())
+		throw std::invalid_argument(clargs.Simulate + ": no policies to simulate");
+	return policies;
 }
 
-
-void FindPruneKeep(vector<timestruct> const& times, vector<size_t> &keep, shared_ptr<int> keep_amt,
-		uint64_t time_compmask)
+// How many entries of lhs aren't in rhs, both sorted
+size_t CountMissing(vector<size_t> const& lhs, vector<size_t> const& rhs)
 {
-	if (!keep_amt || times.empty())
-		return;
-	size_t total_keep = *keep_amt;
-	vector<size_t> add_keep;
-	add_keep.push_back(0); // always keep the most recent.
-	timestruct current_keep = times[0];
-	for (size_t i = 1; i < times.size() && add_keep.size() < total_keep; i++) {
-		// If the current value is equal to the last timestamp kept, do not keep.
-		if (current_keep.EqlMask(times[i], time_compmask))
-			continue;
-		current_keep = times[i];
-		add_keep.push_back(i);
+	size_t missing = 0;
+	size_t j = 0;
+	for (size_t i : lhs) {
+		while (j < rhs.size() && rhs[j] < i)
+			j++;
+		if (j == rhs.size() || rhs[j] != i)
+			missing++;
 	}
-
-	// Merge with keep
-	vector<size_t> merged_keep;
-	auto it = std::set_union(keep.begin(), keep.end(), add_keep.begin(), add_keep.end(),
-			std::inserter(merged_keep, merged_keep.begin()));
-	keep.swap(merged_keep);
+	return missing;
 }
 
-void PruneFiles(CLArgs const& clargs)
+void SimulatePolicies(CLArgs const& clargs, CompiledSpec const& spec)
 {
-	vector<size_t> nowpos;
-	size_t pos = 0;
-	while ((pos = clargs.Spec.find("{now}", pos)) != string::npos)
-		nowpos.push_back(pos++);
-
-	vector<timestruct> input_times;
-	// Read from stdin
+	vector<policy> policies = ReadPolicies(clargs);
+	LineParser parser(spec);
 	char delim = clargs.Newline ? '\n' : '\0';
-	for (string line; std::getline(std::cin, line, delim);) {
-		if (ValidateInputSpec(clargs.Spec, line, nowpos)) {
-			std::cerr << "warn: spec does not match input: " << line << "\n";
-			continue;
+	Listing listing(clargs, spec, delim);
+	vector<keyentry> times = listing.Parse(parser, clargs.Jobs, true, nullptr);
+
+	vector<size_t> first;
+	for (size_t p = 0; p < policies.size(); p++) {
+		vector<size_t> kept = FindKeptEntries(times, policies[p].tiers);
+		cout << policies[p].text << ": keeps " << kept.size() << ", prunes "
+			<< times.size() - kept.size();
+		if (p == 0)
+			first = std::move(kept);
+		else {
+			// Whatever the first policy keeps and this one doesn't is pruned in addition
+			cout << " (vs " << policies[0].text << ": prunes " << CountMissing(first, kept)
+				<< " more, " << CountMissing(kept, first) << " fewer)";
 		}
+		cout << "\n";
+	}
+	cout.flush();
+}
 
-		try {
-			// Only use the first {now} as the official timestamp
-			input_times.push_back(timestruct(string(line.data() + nowpos[0], NOW_SPEC_LENGTH)));
-		}
-		catch (std::invalid_argument const& e) {
-			std::cerr << "warn: in input '" << line << "': " << e.what() << "\n";
-			continue;
-		}
+void PruneBatch(CLArgs const& clargs)
+{
+	vector<CLArgs> config = ReadBatchConfig(clargs.Batch);
+	vector<CompiledSpec> compiled;
+	vector<vector<keeptier>> tiers;
+	for (CLArgs const& line : config) {
+		compiled.emplace_back(line.Spec);
+		tiers.push_back(KeepTiers(line));
 	}
+	SpecSet specs(std::move(compiled));
 
-	if (input_times.empty())
+	char delim = clargs.Newline ? '\n' : '\0';
+	Listing listing(clargs, specs, delim);
+	std::string_view data = listing.Data();
+
+	vector<vector<keyentry>> groups = ParseBatchListing(specs, data, delim);
+	vector<Bitmap> keep = FindBatchKeep(groups, tiers, clargs.Jobs);
+
+	if (clargs.Delete) {
+		std::unique_ptr<EntryRemover> deleter = MakeDeleter(clargs, listing.DirFd());
+		for (size_t g = 0; g < groups.size(); g++) {
+			for (size_t i = 0; i < groups[g].size(); i++) {
+				if (!keep[g].Test(i))
+					deleter->Add(data.substr(groups[g][i].offset, specs[g].NameLength()));
+			}
+		}
+		FinishDelete(*deleter);
 		return;
+	}
 
-	// Sort from most recent to least recent
-	std::sort(input_times.begin(), input_times.end(), SortTimestruct);
-	std::reverse(input_times.begin(), input_times.end());
-
-	// Figure out what to keep based on input
-	vector<size_t> keep;
-	keep.push_back(0); // always keep most recent
-	FindPruneKeep(input_times, keep, clargs.KeepMinutely, COMP_MINUTELY);
-	FindPruneKeep(input_times, keep, clargs.KeepHourly, COMP_HOURLY);
-	FindPruneKeep(input_times, keep, clargs.KeepDaily, COMP_DAILY);
-	FindPruneKeep(input_times, keep, clargs.KeepWeekly, COMP_WEEKLY);
-	FindPruneKeep(input_times, keep, clargs.KeepMonthly, COMP_MONTHLY);
+	OutputBuffer out(STDOUT_FILENO);
+	if (clargs.Vmsplice && listing.Mapped())
+		out.UseVmsplice();
+	for (size_t g = 0; g < groups.size(); g++)
+		WritePruned(groups[g], keep[g], data, specs[g].NameLength(), delim, out);
+	out.Flush();
+}
 
-	// Output what should be pruned
-	for (size_t i = 0; i < input_times.size(); i++) {
-		if (!std::binary_search(keep.begin(), keep.end(), i)) {
-			// Prune it
-			cout << GenerateFileTime(clargs.Spec, input_times[i]) << delim;
-		}
+// Generation mode, which runs often enough that it's kept to a single write and no allocations
+void WriteFileTime(CLArgs const& clargs, CompiledSpec const& spec)
+{
+	system_clock::time_point now = system_clock::now();
+	timestruct t = clargs.Utc ? timestruct(now, 0) : timestruct(now);
+	char buf[512];
+	size_t len = spec.FormatTo(t, buf, sizeof(buf));
+	if (len < sizeof(buf)) {
+		WriteAll(STDOUT_FILENO, buf, len);
+		return;
 	}
+	string name = spec.Format(t);
+	WriteAll(STDOUT_FILENO, name.data(), name.size());
 }
 
-
 int main(int argc, char **argv)
 {
 	CLArgs clargs;
@@ -414,10 +929,54 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
-	if (clargs.Prune)
-		PruneFiles(clargs);
-	else
-		cout << GenerateFileTime(clargs.Spec, timestruct(system_clock::now()));
+	// Nothing reads or writes through stdio, so iostreams don't need to stay in sync with it.
+	std::ios::sync_with_stdio(false);
+
+	if (!clargs.Batch.empty()) {
+		try {
+			PruneBatch(clargs);
+		}
+		catch (std::invalid_argument const& e) {
+			std::cerr << e.what() << "\n";
+			return 1;
+		}
+		catch (std::runtime_error const& e) {
+			std::cerr << e.what() << "\n";
+			return 1;
+		}
+		return 0;
+	}
+
+	CompiledSpec spec(clargs.Spec);
+	if (clargs.Prune) {
+		try {
+			if (!clargs.Simulate.empty())
+				SimulatePolicies(clargs, spec);
+			else if (!clargs.Watch.empty())
+				WatchFiles(clargs, spec);
+			else if (clargs.Presorted)
+				PruneSortedFiles(clargs, spec);
+			else
+				PruneFiles(clargs, spec);
+		}
+		catch (std::invalid_argument const& e) {
+			std::cerr << e.what() << "\n";
+			return 1;
+		}
+		catch (std::runtime_error const& e) {
+			std::cerr << e.what() << "\n";
+			return 1;
+		}
+	}
+	else {
+		try {
+			WriteFileTime(clargs, spec);
+		}
+		catch (std::runtime_error const& e) {
+			std::cerr << e.what() << "\n";
+			return 1;
+		}
+	}
 
 	return 0;
 }
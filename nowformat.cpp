@@ -0,0 +1,242 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "nowformat.h"
+
+#include <cstdio>
+#include <string>
+
+#include "civil.h"
+
+using std::chrono::system_clock;
+
+
+static char *PutDigits(char *out, int64_t value, int width)
+{
+	for (int i = width - 1; i >= 0; i--) {
+		out[i] = char('0' + value % 10);
+		value /= 10;
+	}
+	return out + width;
+}
+
+// Reads n digits, false if any of them isn't one.
+static bool GetDigits(char const* p, int n, int64_t &value)
+{
+	int64_t v = 0;
+	for (int i = 0; i < n; i++) {
+		unsigned d = unsigned(p[i] - '0');
+		if (d > 9)
+			return false;
+		v = v * 10 + d;
+	}
+	value = v;
+	return true;
+}
+
+size_t FormatNow(timestruct const& now, char *out)
+{
+	if (now.year < 0 || now.year > 9999) {
+		return std::snprintf(out, 100, "%04d-%02d-%02dT%02d:%02d:%02d",
+				now.year, now.mon, now.mday,
+				now.hour, now.min, now.sec
+				);
+	}
+	char *p = PutDigits(out, now.year, 4);
+	*p++ = '-';
+	p = PutDigits(p, now.mon, 2);
+	*p++ = '-';
+	p = PutDigits(p, now.mday, 2);
+	*p++ = 'T';
+	p = PutDigits(p, now.hour, 2);
+	*p++ = ':';
+	p = PutDigits(p, now.min, 2);
+	*p++ = ':';
+	p = PutDigits(p, now.sec, 2);
+	return p - out;
+}
+
+// Milliseconds since 1970-01-01 UTC
+static int64_t UtcMs(timestruct const& now)
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(
+			now.tp.time_since_epoch()).count();
+}
+
+// Seconds since 1970-01-01 of the time in key, dropping the milliseconds
+static int64_t KeySeconds(timekey key)
+{
+	int64_t year = int64_t(key >> KEY_YEAR_SHIFT) - KEY_YEAR_BIAS;
+	int mon = int((key & KEY_MON) >> KEY_MON_SHIFT);
+	int mday = int((key & KEY_MDAY) >> KEY_MDAY_SHIFT);
+	int hour = int((key & KEY_HOUR) >> KEY_HOUR_SHIFT);
+	int min = int((key & KEY_MIN) >> KEY_MIN_SHIFT);
+	int sec = int((key & KEY_SEC) >> KEY_SEC_SHIFT);
+	return DaysFromCivil(year, mon, mday) * 86400 + hour * 3600 + min * 60 + sec;
+}
+
+// The iso formats share their first NOW_SPEC_LENGTH bytes, so they all start from ParseTimeKeys
+
+static void ParseIsoMs(char const* const* nows, size_t count, timekey *keys, bool *valid)
+{
+	ParseTimeKeys(nows, count, keys, valid);
+	for (size_t i = 0; i < count; i++) {
+		char const* s = nows[i] + NOW_SPEC_LENGTH;
+		int64_t ms;
+		if (valid[i])
+			valid[i] = s[0] == '.' && GetDigits(s + 1, 3, ms);
+		if (valid[i])
+			keys[i] |= timekey(ms) << KEY_MS_SHIFT;
+	}
+}
+
+static size_t FormatIsoMs(timestruct const& now, char *out)
+{
+	size_t len = FormatNow(now, out);
+	out[len] = '.';
+	PutDigits(out + len + 1, FloorMod(UtcMs(now), 1000), 3);
+	return len + 4;
+}
+
+static void ParseIsoZ(char const* const* nows, size_t count, timekey *keys, bool *valid)
+{
+	// The fields are UTC already, only the 'Z' is left to check
+	ParseTimeKeys(nows, count, keys, valid);
+	for (size_t i = 0; i < count; i++) {
+		if (valid[i])
+			valid[i] = nows[i][NOW_SPEC_LENGTH] == 'Z';
+	}
+}
+
+static size_t FormatIsoZ(timestruct const& now, char *out)
+{
+	size_t len = FormatNow(timestruct(now.tp, 0), out);
+	out[len] = 'Z';
+	return len + 1;
+}
+
+static void ParseIsoOffset(char const* const* nows, size_t count, timekey *keys, bool *valid)
+{
+	ParseTimeKeys(nows, count, keys, valid);
+	for (size_t i = 0; i < count; i++) {
+		if (!valid[i])
+			continue;
+		// "+HH:MM"
+		char const* s = nows[i] + NOW_SPEC_LENGTH;
+		int64_t hh, mm;
+		valid[i] = (s[0] == '+' || s[0] == '-') && GetDigits(s + 1, 2, hh) && s[3] == ':'
+			&& GetDigits(s + 4, 2, mm) && hh < 24 && mm < 60;
+		if (valid[i]) {
+			int64_t offset = (hh * 60 + mm) * 60;
+			int64_t utc = KeySeconds(keys[i]) - (s[0] == '-' ? -offset : offset);
+			keys[i] = PackTime(utc);
+		}
+	}
+}
+
+static size_t FormatIsoOffset(timestruct const& now, char *out)
+{
+	size_t len = FormatNow(now, out);
+	int64_t local = DaysFromCivil(now.year, now.mon, now.mday) * 86400
+		+ now.hour * 3600 + now.min * 60 + now.sec;
+	int64_t offset = local - FloorDiv(UtcMs(now), 1000);
+	char *p = out + len;
+	*p++ = offset < 0 ? '-' : '+';
+	// Offsets that aren't whole minutes only show up in historical local mean time
+	int64_t minutes = (offset < 0 ? -offset : offset) / 60;
+	p = PutDigits(p, minutes / 60, 2);
+	*p++ = ':';
+	p = PutDigits(p, minutes % 60, 2);
+	return p - out;
+}
+
+/* The epoch formats are zero padded to a fixed width, which covers 1970 to 2286, so names still
+ * sort and match by length. Instants outside of that are written as plain numbers, which the
+ * spec then doesn't match, the same as a year past 9999.
+ */
+static const int EPOCH_DIGITS = 10;
+static const int EPOCH_MS_DIGITS = 13;
+
+static void ParseEpoch(char const* const* nows, size_t count, timekey *keys, bool *valid)
+{
+	for (size_t i = 0; i < count; i++) {
+		int64_t utc;
+		valid[i] = GetDigits(nows[i], EPOCH_DIGITS, utc);
+		if (valid[i])
+			keys[i] = PackTime(utc);
+	}
+}
+
+static size_t FormatEpoch(timestruct const& now, char *out)
+{
+	int64_t utc = system_clock::to_time_t(now.tp);
+	if (utc < 0 || utc >= 10000000000)
+		return std::snprintf(out, 100, "%lld", (long long)utc);
+	return PutDigits(out, utc, EPOCH_DIGITS) - out;
+}
+
+static void ParseEpochMs(char const* const* nows, size_t count, timekey *keys, bool *valid)
+{
+	for (size_t i = 0; i < count; i++) {
+		int64_t utc_ms;
+		valid[i] = GetDigits(nows[i], EPOCH_MS_DIGITS, utc_ms);
+		if (valid[i])
+			keys[i] = PackTime(utc_ms / 1000, int(utc_ms % 1000));
+	}
+}
+
+static size_t FormatEpochMs(timestruct const& now, char *out)
+{
+	int64_t utc_ms = UtcMs(now);
+	if (utc_ms < 0 || utc_ms >= 10000000000000)
+		return std::snprintf(out, 100, "%lld", (long long)utc_ms);
+	return PutDigits(out, utc_ms, EPOCH_MS_DIGITS) - out;
+}
+
+static const nowformat NOW_FORMATS[] = {
+	{ "iso",        NOW_SPEC_LENGTH,     ParseTimeKeys,  FormatNow },
+	{ "iso-ms",     NOW_SPEC_LENGTH + 4, ParseIsoMs,     FormatIsoMs },
+	{ "iso-z",      NOW_SPEC_LENGTH + 1, ParseIsoZ,      FormatIsoZ },
+	{ "iso-offset", NOW_SPEC_LENGTH + 6, ParseIsoOffset, FormatIsoOffset },
+	{ "epoch",      EPOCH_DIGITS,        ParseEpoch,     FormatEpoch },
+	{ "epoch-ms",   EPOCH_MS_DIGITS,     ParseEpochMs,   FormatEpochMs },
+};
+
+nowformat const& DefaultNowFormat()
+{
+	return NOW_FORMATS[0];
+}
+
+nowformat const* FindNowFormat(std::string_view name)
+{
+	for (nowformat const& f : NOW_FORMATS) {
+		if (name == f.name)
+			return &f;
+	}
+	return nullptr;
+}
+
+char const* NowFormatNames()
+{
+	static const std::string names = []() {
+		std::string s;
+		for (nowformat const& f : NOW_FORMATS) {
+			if (!s.empty())
+				s += ", ";
+			s += f.name;
+		}
+		return s;
+	}();
+	return names.c_str();
+}
@@ -0,0 +1,65 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+
+#include "timekey.h"
+#include "timestruct.h"
+
+
+/* How a {now:fmt} is written and read back. Every format has a fixed width, so a spec still
+ * matches names of one length, and a parser and formatter made for it alone. The entry is picked
+ * when the spec is compiled, so nothing is looked up per name.
+ *
+ *   iso         2020-01-12T13:45:00            local time, what a plain {now} is
+ *   iso-ms      2020-01-12T13:45:00.250        local time with milliseconds
+ *   iso-z       2020-01-12T12:45:00Z           UTC
+ *   iso-offset  2020-01-12T13:45:00+01:00      local time and its UTC offset
+ *   epoch       1578833100                     seconds since 1970-01-01 UTC, 10 digits
+ *   epoch-ms    1578833100250                  milliseconds since 1970-01-01 UTC, 13 digits
+ *
+ * iso and iso-ms only show the wall clock, so their keys are local time. The other formats carry
+ * an instant and are keyed by its UTC time instead, which keeps their keys in the order the names
+ * were made even when the clocks go back. Their tiers then count UTC minutes, days and so on.
+ */
+struct nowformat {
+	char const* name;
+	size_t width;
+	/* Parses count values, nows[i] pointing at width bytes. valid[i] says whether nows[i]
+	 * parsed, keys[i] is only set if it did.
+	 */
+	void (*parse)(char const* const* nows, size_t count, timekey *keys, bool *valid);
+	/* Writes now to out, which has room for at least 100 characters. Returns the number of
+	 * characters written, width unless the time doesn't fit in it (e.g. a year past 9999).
+	 */
+	size_t (*format)(timestruct const& now, char *out);
+};
+
+// The format of a plain {now}
+nowformat const& DefaultNowFormat();
+
+// The format called name, nullptr if there is none.
+nowformat const* FindNowFormat(std::string_view name);
+
+// Names of every format, separated by ", ", for error messages.
+char const* NowFormatNames();
+
+/* Writes now as "YYYY-MM-DDTHH:MM:SS" to out, which has room for at least 100 characters.
+ * Returns the number of characters written, NOW_SPEC_LENGTH unless the year has more than four
+ * digits. This is the iso format.
+ */
+size_t FormatNow(timestruct const& now, char *out);
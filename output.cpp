@@ -0,0 +1,165 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "output.h"
+
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+// References shorter than this are copied, unless they continue the previous one
+static const size_t MIN_REF = 512;
+
+OutputBuffer::OutputBuffer(int fd, size_t capacity)
+	: fd(fd),
+	capacity(capacity),
+	buf(new char[capacity]),
+	used(0),
+	ref(nullptr),
+	ref_len(0),
+	vmsplice(false)
+{
+}
+
+bool OutputBuffer::Buffered(iovec const& v) const
+{
+	char const* p = static_cast<char const*>(v.iov_base);
+	return p >= buf.get() && p < buf.get() + capacity;
+}
+
+void OutputBuffer::AddSegment(char const* p, size_t len)
+{
+	segments.push_back(iovec{ const_cast<char *>(p), len });
+}
+
+void OutputBuffer::Append(std::string_view bytes)
+{
+	EndRef();
+	if (used + bytes.size() > capacity || segments.size() >= IOV_MAX)
+		Flush();
+	if (bytes.size() >= capacity) {
+		// Too large to be worth copying
+		WriteAll(fd, bytes.data(), bytes.size());
+		return;
+	}
+	char *dest = buf.get() + used;
+	std::memcpy(dest, bytes.data(), bytes.size());
+	used += bytes.size();
+	if (!segments.empty() && Buffered(segments.back())
+			&& static_cast<char *>(segments.back().iov_base) + segments.back().iov_len == dest)
+		segments.back().iov_len += bytes.size();
+	else
+		AddSegment(dest, bytes.size());
+}
+
+void OutputBuffer::Append(char c)
+{
+	Append(std::string_view(&c, 1));
+}
+
+void OutputBuffer::AppendRef(std::string_view bytes)
+{
+	if (ref && ref + ref_len == bytes.data()) {
+		ref_len += bytes.size();
+		return;
+	}
+	EndRef();
+	ref = bytes.data();
+	ref_len = bytes.size();
+}
+
+void OutputBuffer::EndRef()
+{
+	if (!ref)
+		return;
+	char const* p = ref;
+	size_t len = ref_len;
+	ref = nullptr;
+	ref_len = 0;
+	if (len < MIN_REF)
+		Append(std::string_view(p, len));
+	else {
+		if (segments.size() >= IOV_MAX)
+			Flush();
+		AddSegment(p, len);
+	}
+}
+
+bool OutputBuffer::UseVmsplice()
+{
+	struct stat st;
+	vmsplice = fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode);
+	return vmsplice;
+}
+
+void OutputBuffer::Flush()
+{
+	EndRef();
+	size_t i = 0;
+	while (i < segments.size()) {
+		// Buffered bytes get reused, so only references can go through vmsplice
+		bool splice = vmsplice && !Buffered(segments[i]);
+		size_t j = i + 1;
+		while (j < segments.size() && (vmsplice && !Buffered(segments[j])) == splice)
+			j++;
+		WriteSegments(segments.data() + i, j - i, splice);
+		i = j;
+	}
+	segments.clear();
+	used = 0;
+}
+
+void OutputBuffer::WriteSegments(iovec *v, size_t count, bool splice)
+{
+	while (count > 0) {
+		ssize_t n = splice ? ::vmsplice(fd, v, count, 0) : writev(fd, v, count);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && splice && errno == EINVAL) {
+			// Not a pipe after all
+			vmsplice = splice = false;
+			continue;
+		}
+		if (n < 0)
+			throw std::system_error(errno, std::generic_category(), "failed to write output");
+		while (count > 0 && size_t(n) >= v->iov_len) {
+			n -= v->iov_len;
+			v++;
+			count--;
+		}
+		if (count > 0) {
+			v->iov_base = static_cast<char *>(v->iov_base) + n;
+			v->iov_len -= n;
+		}
+	}
+}
+
+void WriteAll(int fd, char const* data, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, data, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			throw std::system_error(errno, std::generic_category(), "failed to write output");
+		data += n;
+		len -= n;
+	}
+}
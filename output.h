@@ -0,0 +1,70 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include <sys/uio.h>
+
+
+/* Collects output and hands it to writev(2) one large batch at a time. Call Flush() once done,
+ * anything still buffered when the OutputBuffer is destroyed is dropped.
+ */
+class OutputBuffer {
+public:
+	explicit OutputBuffer(int fd, size_t capacity = 1 << 16);
+
+	OutputBuffer(OutputBuffer const&) =delete;
+	OutputBuffer& operator=(OutputBuffer const&) =delete;
+
+	// Copies bytes into the buffer.
+	void Append(std::string_view bytes);
+	void Append(char c);
+	/* Like Append(bytes), but bytes have to stay valid and unchanged until the next Flush(). Runs
+	 * of references that are next to each other in memory are written straight from there, short
+	 * ones on their own are copied.
+	 */
+	void AppendRef(std::string_view bytes);
+	/* Hands references to fd with vmsplice(2) instead of copying them, if fd is a pipe. Then they
+	 * have to stay unchanged until the reader at the other end has read them, which in practice
+	 * means they must be read-only mappings. Returns false if fd isn't a pipe.
+	 */
+	bool UseVmsplice();
+	// Writes everything buffered so far. Throws std::system_error on failure.
+	void Flush();
+
+private:
+	void AddSegment(char const* p, size_t len);
+	void EndRef();
+	bool Buffered(iovec const& v) const;
+	void WriteSegments(iovec *v, size_t count, bool splice);
+
+	int fd;
+	size_t capacity;
+	std::unique_ptr<char[]> buf;
+	size_t used;
+	// What is written next, in order, both buffered bytes and references
+	std::vector<iovec> segments;
+	// The reference runs being collected, not in segments yet
+	char const* ref;
+	size_t ref_len;
+	bool vmsplice;
+};
+
+// write(2) until everything is out or an error occurs. Throws std::system_error on failure.
+void WriteAll(int fd, char const* data, size_t len);
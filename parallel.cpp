@@ -0,0 +1,88 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "parallel.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+using std::vector;
+
+
+vector<std::string_view> SplitLines(std::string_view data, char delim, size_t parts)
+{
+	vector<std::string_view> pieces;
+	if (parts == 0)
+		parts = 1;
+	size_t start = 0;
+	for (size_t p = 1; p < parts && start < data.size(); p++) {
+		size_t target = std::max(start, data.size() / parts * p);
+		void const* nl = std::memchr(data.data() + target, delim, data.size() - target);
+		if (!nl)
+			break;
+		size_t end = static_cast<char const*>(nl) - data.data() + 1;
+		pieces.push_back(data.substr(start, end - start));
+		start = end;
+	}
+	if (start < data.size() || pieces.empty())
+		pieces.push_back(data.substr(start));
+	return pieces;
+}
+
+static bool MoreRecent(keyentry const& lhs, keyentry const& rhs)
+{
+	return lhs.key > rhs.key;
+}
+
+vector<keyentry> MergeDescending(vector<vector<keyentry>> &runs, size_t jobs)
+{
+	if (runs.empty())
+		return {};
+
+	// Merge neighbouring pairs until one run is left. Keeping neighbours together (and
+	// std::merge preferring its first range) is what keeps ties in input order.
+	while (runs.size() > 1) {
+		vector<vector<keyentry>> merged((runs.size() + 1) / 2);
+		auto merge_pair = [&runs, &merged](size_t i) {
+			if (2 * i + 1 == runs.size()) {
+				merged[i].swap(runs[2 * i]);
+				return;
+			}
+			vector<keyentry> &lhs = runs[2 * i];
+			vector<keyentry> &rhs = runs[2 * i + 1];
+			merged[i].resize(lhs.size() + rhs.size());
+			std::merge(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), merged[i].begin(),
+					MoreRecent);
+			vector<keyentry>().swap(lhs);
+			vector<keyentry>().swap(rhs);
+		};
+
+		vector<std::thread> threads;
+		for (size_t i = 0; i < merged.size(); i++) {
+			if (threads.size() + 1 < jobs)
+				threads.emplace_back(merge_pair, i);
+			else
+				merge_pair(i);
+		}
+		for (std::thread &t : threads)
+			t.join();
+		runs.swap(merged);
+	}
+
+	vector<keyentry> out;
+	out.swap(runs[0]);
+	runs.clear();
+	return out;
+}
@@ -0,0 +1,34 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+#include "timekey.h"
+
+
+/* Splits data into at most parts pieces of roughly equal size. Every piece but the last ends just
+ * after a delim, so no line is cut in half and running ForEachLine over each piece in order gives
+ * the same lines as running it over data.
+ */
+std::vector<std::string_view> SplitLines(std::string_view data, char delim, size_t parts);
+
+/* Merges runs that are each sorted most recent first into one sorted listing, using up to jobs
+ * threads. Equal keys keep the order of the runs they came from, so the result is the same as
+ * RadixSortDescending over the concatenation of runs. runs is left empty.
+ */
+std::vector<keyentry> MergeDescending(std::vector<std::vector<keyentry>> &runs, size_t jobs);
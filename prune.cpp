@@ -0,0 +1,216 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "prune.h"
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <thread>
+
+#include "input.h"
+#include "parallel.h"
+
+using std::string;
+using std::vector;
+
+
+string GenerateFileTime(CompiledSpec const& Spec, timestruct const& now)
+{
+	return Spec.Format(now);
+}
+
+bool ValidateInputSpec(CompiledSpec const& Spec, std::string_view line)
+{
+	return !Spec.Matches(line);
+}
+
+bool LineParser::Parse(std::string_view line, timekey &key, std::ostream &warn) const
+{
+	if (ValidateInputSpec(Spec, line)) {
+		warn << "warn: spec does not match input: " << line << "\n";
+		return false;
+	}
+	if (!Spec.ParseNow(line, key)) {
+		warn << "warn: in input '" << line << "': " << BAD_NOW_FORMAT << "\n";
+		return false;
+	}
+	return true;
+}
+
+void parsestats::Add(parsestats const& other)
+{
+	lines += other.lines;
+	spec_mismatch += other.spec_mismatch;
+	bad_time += other.bad_time;
+	validate += other.validate;
+	parse += other.parse;
+	sort += other.sort;
+}
+
+// Lines are parsed this many at a time, so their {now} values can be converted together
+static const size_t PARSE_BATCH = 256;
+
+void LineParser::ParseAll(std::string_view data, char delim, char const* base,
+		vector<keyentry> &out, std::ostream &warn, parsestats *stats) const
+{
+	std::string_view lines[PARSE_BATCH];
+	bool matches[PARSE_BATCH];
+	char const* nows[PARSE_BATCH];
+	timekey keys[PARSE_BATCH];
+	bool valid[PARSE_BATCH];
+	size_t count = 0;
+	// Every entry takes a whole name plus its delimiter, so this is as many as there can be and
+	// out never has to grow while parsing
+	out.reserve(out.size() + data.size() / (Spec.NameLength() + 1) + 1);
+
+	parsestats local;
+	bool timed = stats && stats->timed;
+	// Only read the clock once per batch, so timing doesn't cost much either
+	auto flush = [&]() {
+		std::chrono::steady_clock::time_point start;
+		if (timed)
+			start = std::chrono::steady_clock::now();
+		size_t now_count = 0;
+		for (size_t i = 0; i < count; i++) {
+			matches[i] = Spec.Matches(lines[i]);
+			if (matches[i])
+				nows[now_count++] = Spec.Now(lines[i]).data();
+		}
+		std::chrono::steady_clock::time_point validated;
+		if (timed) {
+			validated = std::chrono::steady_clock::now();
+			local.validate += std::chrono::duration<double>(validated - start).count();
+		}
+		Spec.NowFormat().parse(nows, now_count, keys, valid);
+		if (timed) {
+			local.parse += std::chrono::duration<double>(
+					std::chrono::steady_clock::now() - validated).count();
+		}
+
+		size_t n = 0;
+		for (size_t i = 0; i < count; i++) {
+			if (!matches[i]) {
+				local.spec_mismatch++;
+				warn << "warn: spec does not match input: " << lines[i] << "\n";
+			}
+			else if (!valid[n++]) {
+				local.bad_time++;
+				warn << "warn: in input '" << lines[i] << "': " << BAD_NOW_FORMAT << "\n";
+			}
+			else
+				out.push_back(keyentry{ keys[n - 1], uint64_t(lines[i].data() - base) });
+		}
+		local.lines += count;
+		count = 0;
+	};
+	ForEachLine(data, delim, [&](std::string_view line) {
+		lines[count++] = line;
+		if (count == PARSE_BATCH)
+			flush();
+	});
+	flush();
+	if (stats)
+		stats->Add(local);
+}
+
+
+// Below this much input per thread, starting threads costs more than it saves
+static const size_t PARALLEL_MIN_CHUNK = 1 << 16;
+
+// Parses data with up to jobs threads, into one run per piece, each sorted if sort is set
+static vector<vector<keyentry>> ParsePieces(LineParser const& parser, std::string_view data,
+		char delim, size_t jobs, std::ostream &warn, parsestats *stats, bool sort)
+{
+	jobs = std::min(jobs, data.size() / PARALLEL_MIN_CHUNK + 1);
+	vector<std::string_view> pieces = SplitLines(data, delim, jobs);
+	vector<vector<keyentry>> runs(pieces.size());
+	// Each thread keeps its warnings, so they can be printed in input order afterwards
+	vector<std::ostringstream> warnings(pieces.size());
+	vector<parsestats> piece_stats(pieces.size());
+
+	auto parse_piece = [&](size_t i) {
+		parsestats *ps = nullptr;
+		if (stats) {
+			piece_stats[i].timed = stats->timed;
+			ps = &piece_stats[i];
+		}
+		parser.ParseAll(pieces[i], delim, data.data(), runs[i], warnings[i], ps);
+		if (!sort)
+			return;
+		std::chrono::steady_clock::time_point start;
+		if (ps && ps->timed)
+			start = std::chrono::steady_clock::now();
+		// Sort from most recent to least recent
+		RadixSortDescending(runs[i]);
+		if (ps && ps->timed) {
+			ps->sort += std::chrono::duration<double>(
+					std::chrono::steady_clock::now() - start).count();
+		}
+	};
+	vector<std::thread> threads;
+	for (size_t i = 1; i < pieces.size(); i++)
+		threads.emplace_back(parse_piece, i);
+	parse_piece(0);
+	for (std::thread &t : threads)
+		t.join();
+
+	for (std::ostringstream const& w : warnings)
+		warn << w.str();
+	if (stats) {
+		for (parsestats const& ps : piece_stats)
+			stats->Add(ps);
+	}
+	return runs;
+}
+
+vector<keyentry> ParseListing(LineParser const& parser, std::string_view data, char delim,
+		size_t jobs, std::ostream &warn, parsestats *stats)
+{
+	vector<vector<keyentry>> runs = ParsePieces(parser, data, delim, jobs, warn, stats, true);
+	return MergeDescending(runs, jobs);
+}
+
+vector<keyentry> ParseListingUnsorted(LineParser const& parser, std::string_view data,
+		char delim, size_t jobs, std::ostream &warn, parsestats *stats)
+{
+	vector<vector<keyentry>> runs = ParsePieces(parser, data, delim, jobs, warn, stats, false);
+	if (runs.size() == 1)
+		return std::move(runs[0]);
+	vector<keyentry> entries;
+	size_t total = 0;
+	for (vector<keyentry> const& run : runs)
+		total += run.size();
+	entries.reserve(total);
+	for (vector<keyentry> const& run : runs)
+		entries.insert(entries.end(), run.begin(), run.end());
+	return entries;
+}
+
+void WritePruned(vector<keyentry> const& times, Bitmap const& keep, std::string_view data,
+		size_t name_len, char delim, OutputBuffer &out)
+{
+	for (size_t i = 0; i < times.size(); i++) {
+		if (!keep.Test(i)) {
+			// Prune it, along with the delimiter it came with if it has one
+			size_t end = times[i].offset + name_len;
+			if (end < data.size() && data[end] == delim)
+				out.AppendRef(data.substr(times[i].offset, name_len + 1));
+			else {
+				out.AppendRef(data.substr(times[i].offset, name_len));
+				out.Append(delim);
+			}
+		}
+	}
+}
@@ -0,0 +1,87 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "output.h"
+#include "retention.h"
+#include "spec.h"
+#include "timekey.h"
+#include "timestruct.h"
+
+
+std::string GenerateFileTime(CompiledSpec const& Spec, timestruct const& now);
+
+/* What LineParser::ParseAll saw. Times are only taken when timed is set, and add up over threads.
+ */
+struct parsestats {
+	bool timed = false;
+	size_t lines = 0;
+	size_t spec_mismatch = 0; // rejected by ValidateInputSpec
+	size_t bad_time = 0;      // matched, but the {now} didn't parse
+	double validate = 0;
+	double parse = 0;
+	double sort = 0;
+
+	void Add(parsestats const& other);
+};
+
+// Returns true if line does not match the spec.
+bool ValidateInputSpec(CompiledSpec const& Spec, std::string_view line);
+
+/* Checks a line of the --prune list against the spec and parses its timestamp, warning about
+ * lines that don't work out.
+ */
+class LineParser {
+public:
+	explicit LineParser(CompiledSpec const& Spec)
+		: Spec(Spec)
+	{
+	}
+
+	bool Parse(std::string_view line, timekey &key, std::ostream &warn = std::cerr) const;
+	/* Parse() for every delim separated line of data, with the {now} values converted in batches.
+	 * Entries are appended to out with offsets relative to base, warnings come out in input order.
+	 * Counts (and with stats->timed, times) are added to stats if given.
+	 */
+	void ParseAll(std::string_view data, char delim, char const* base, std::vector<keyentry> &out,
+			std::ostream &warn = std::cerr, parsestats *stats = nullptr) const;
+
+private:
+	CompiledSpec const& Spec;
+};
+
+/* Parses all of data into entries sorted most recent first. With jobs > 1, data is cut into
+ * pieces on line boundaries that are parsed and sorted by their own thread, then merged.
+ * Warnings go to warn in input order either way, stats is added up over all pieces.
+ */
+std::vector<keyentry> ParseListing(LineParser const& parser, std::string_view data, char delim,
+		size_t jobs, std::ostream &warn = std::cerr, parsestats *stats = nullptr);
+
+// ParseListing without the sort, entries stay in input order.
+std::vector<keyentry> ParseListingUnsorted(LineParser const& parser, std::string_view data,
+		char delim, size_t jobs, std::ostream &warn = std::cerr, parsestats *stats = nullptr);
+
+/* Writes the name of every entry of times that keep doesn't have, each followed by delim. Names
+ * are echoed back exactly as they were read from data, and referenced rather than copied, so data
+ * has to outlive the next out.Flush().
+ */
+void WritePruned(std::vector<keyentry> const& times, Bitmap const& keep, std::string_view data,
+		size_t name_len, char delim, OutputBuffer &out);
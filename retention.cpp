@@ -0,0 +1,478 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "retention.h"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+#include <utility>
+
+using std::string;
+using std::vector;
+
+
+namespace {
+// Per tier state while walking the listing
+struct tierstate {
+	bucketing bucket;
+	size_t remaining;   // buckets still to be kept
+	int64_t current;    // bucket of the most recent entry kept for this tier
+};
+}
+
+/* Specialized kernels for the common case where every tier has a different fixed unit (no
+ * --keep-every). The set of tiers that still have buckets left is a template parameter, so a
+ * kernel only holds the bucket computations that are actually needed. When a tier fills up, the
+ * walk carries on in the kernel without it.
+ */
+namespace {
+// Units with their own bit in a kernel mask, everything before BUCKET_MINUTES
+const int FIXED_UNITS = BUCKET_MINUTES;
+
+struct fixedstate {
+	int64_t current[FIXED_UNITS];
+	size_t remaining[FIXED_UNITS];
+};
+
+template <unsigned Mask>
+void FindPruneKeepFixed(vector<keyentry> const& times, size_t i, fixedstate &st, Bitmap &keep);
+
+typedef void (*keep_kernel)(vector<keyentry> const&, size_t, fixedstate &, Bitmap &);
+
+template <size_t... Masks>
+constexpr std::array<keep_kernel, sizeof...(Masks)> MakeKernels(std::index_sequence<Masks...>)
+{
+	return {{ &FindPruneKeepFixed<unsigned(Masks)>... }};
+}
+
+// Indexed by the set of units with buckets left
+const std::array<keep_kernel, 1 << FIXED_UNITS> KEEP_KERNELS
+	= MakeKernels(std::make_index_sequence<1 << FIXED_UNITS>());
+
+// Returns the tier's bit once it's full
+template <bucketunit Unit>
+inline unsigned KeepStep(timekey key, size_t i, fixedstate &st, Bitmap &keep)
+{
+	int64_t id = BucketId(key, bucketing{ Unit, 0 });
+	if (id == st.current[Unit])
+		return 0;
+	st.current[Unit] = id;
+	keep.Set(i);
+	return --st.remaining[Unit] == 0 ? 1u << Unit : 0;
+}
+
+template <unsigned Mask>
+void FindPruneKeepFixed(vector<keyentry> const& times, size_t i, fixedstate &st, Bitmap &keep)
+{
+	if constexpr (Mask != 0) {
+#define KEEP_STEP(unit) \
+		if constexpr ((Mask & (1u << unit)) != 0) \
+			full |= KeepStep<unit>(key, i, st, keep)
+
+		for (; i < times.size(); i++) {
+			timekey key = times[i].key;
+			unsigned full = 0;
+			KEEP_STEP(BUCKET_MINUTE);
+			KEEP_STEP(BUCKET_HOUR);
+			KEEP_STEP(BUCKET_DAY);
+			KEEP_STEP(BUCKET_WEEK);
+			KEEP_STEP(BUCKET_MONTH);
+			KEEP_STEP(BUCKET_QUARTER);
+			KEEP_STEP(BUCKET_YEAR);
+			if (full) {
+				KEEP_KERNELS[Mask & ~full](times, i + 1, st, keep);
+				return;
+			}
+		}
+#undef KEEP_STEP
+	}
+}
+}
+
+void FindPruneKeep(vector<keyentry> const& times, vector<keeptier> const& tiers, Bitmap &keep)
+{
+	if (times.empty())
+		return;
+	keep.Set(0); // always keep the most recent.
+
+	unsigned mask = 0;
+	bool fixed = true;
+	fixedstate st;
+	for (keeptier const& t : tiers) {
+		unsigned bit = 1u << t.bucket.unit;
+		if (t.bucket.unit >= FIXED_UNITS || (mask & bit)) {
+			fixed = false;
+			break;
+		}
+		st.current[t.bucket.unit] = BucketId(times[0].key, t.bucket);
+		st.remaining[t.bucket.unit] = t.keep - 1;
+		// The most recent entry already counts as the first bucket of every tier
+		if (t.keep > 1)
+			mask |= bit;
+	}
+	if (fixed) {
+		KEEP_KERNELS[mask](times, 1, st, keep);
+		return;
+	}
+
+	vector<tierstate> active;
+	for (keeptier const& t : tiers) {
+		// The most recent entry already counts as the first bucket of every tier
+		if (t.keep > 1)
+			active.push_back(tierstate{ t.bucket, t.keep - 1, BucketId(times[0].key, t.bucket) });
+	}
+
+	for (size_t i = 1; i < times.size() && !active.empty(); i++) {
+		timekey key = times[i].key;
+		for (size_t t = 0; t < active.size();) {
+			tierstate &s = active[t];
+			// Still in the bucket of the last entry kept, do not keep.
+			int64_t id = BucketId(key, s.bucket);
+			if (id == s.current) {
+				t++;
+				continue;
+			}
+			s.current = id;
+			keep.Set(i);
+			if (--s.remaining == 0) {
+				// Tier is full, stop looking at it
+				s = active.back();
+				active.pop_back();
+				continue;
+			}
+			t++;
+		}
+	}
+}
+
+vector<size_t> FindKeptEntries(vector<keyentry> const& times, vector<keeptier> const& tiers)
+{
+	vector<size_t> kept;
+	if (times.empty())
+		return kept;
+	kept.push_back(0);
+	for (keeptier const& t : tiers) {
+		size_t i = 0;
+		for (size_t n = 1; n < t.keep; n++) {
+			// Bucket ids only go down along times, so the next bucket starts at the first older id
+			int64_t id = BucketId(times[i].key, t.bucket);
+			i = std::partition_point(times.begin() + i + 1, times.end(),
+					[&t, id](keyentry const& e) { return BucketId(e.key, t.bucket) == id; })
+				- times.begin();
+			if (i == times.size())
+				break;
+			kept.push_back(i);
+		}
+	}
+	std::sort(kept.begin(), kept.end());
+	kept.erase(std::unique(kept.begin(), kept.end()), kept.end());
+	return kept;
+}
+
+namespace {
+// The newest buckets of a tier found so far, most recent first, each with its most recent entry
+struct topbuckets {
+	keeptier tier;
+	std::vector<std::pair<int64_t, size_t>> heads; // bucket, index into times
+	// Most recent time found to be older than all of heads. Heads only ever get newer, so
+	// anything older than this can't make it either.
+	timekey rejected;
+};
+}
+
+/* Past this many buckets in a tier, keeping heads ordered costs more than sorting everything.
+ */
+static const size_t TOP_BUCKETS_MAX = 4096;
+
+void FindPruneKeepUnsorted(vector<keyentry> const& times, vector<keeptier> const& tiers,
+		Bitmap &keep)
+{
+	if (times.empty())
+		return;
+	bool small = std::all_of(tiers.begin(), tiers.end(),
+			[](keeptier const& t) { return t.keep <= TOP_BUCKETS_MAX; });
+	if (!small) {
+		vector<keyentry> sorted(times.size());
+		for (size_t i = 0; i < times.size(); i++)
+			sorted[i] = keyentry{ times[i].key, i };
+		RadixSortDescending(sorted);
+		Bitmap sorted_keep(sorted.size());
+		FindPruneKeep(sorted, tiers, sorted_keep);
+		for (size_t i = 0; i < sorted.size(); i++) {
+			if (sorted_keep.Test(i))
+				keep.Set(sorted[i].offset);
+		}
+		return;
+	}
+
+	vector<topbuckets> top;
+	for (keeptier const& t : tiers) {
+		// Keeping one bucket (or none) keeps only the most recent entry, which happens anyway
+		if (t.keep > 1)
+			top.push_back(topbuckets{ t, {}, 0 });
+	}
+	// Anything older than this is rejected by every tier, which is most entries before long
+	timekey floor = 0;
+	// Going in input order, a tie never replaces what is there already, like a stable sort
+	size_t newest = 0;
+	for (size_t i = 0; i < times.size(); i++) {
+		timekey key = times[i].key;
+		if (key > times[newest].key)
+			newest = i;
+		if (key < floor)
+			continue;
+		for (topbuckets &t : top) {
+			if (key < t.rejected)
+				continue;
+			int64_t id = BucketId(key, t.tier.bucket);
+			auto &heads = t.heads;
+			// Older than every bucket the tier keeps
+			if (heads.size() == t.tier.keep && id < heads.back().first) {
+				t.rejected = key;
+				floor = std::min_element(top.begin(), top.end(),
+						[](topbuckets const& l, topbuckets const& r) {
+							return l.rejected < r.rejected;
+						})->rejected;
+				continue;
+			}
+			size_t pos = std::lower_bound(heads.begin(), heads.end(), id,
+					[](std::pair<int64_t, size_t> const& h, int64_t id) { return h.first > id; })
+				- heads.begin();
+			if (pos < heads.size() && heads[pos].first == id) {
+				if (key > times[heads[pos].second].key)
+					heads[pos].second = i;
+				continue;
+			}
+			if (heads.size() == t.tier.keep)
+				heads.pop_back();
+			heads.insert(heads.begin() + pos, std::make_pair(id, i));
+		}
+	}
+
+	keep.Set(newest);
+	for (topbuckets const& t : top) {
+		for (std::pair<int64_t, size_t> const& h : t.heads)
+			keep.Set(h.second);
+	}
+}
+
+
+StreamingPruner::StreamingPruner(vector<keeptier> const& tiers, prune_fn prune)
+	: tiers(tiers),
+	prune(std::move(prune)),
+	dir(UNKNOWN),
+	started(false),
+	first(0),
+	last(0),
+	newest(0)
+{
+	// Like FindPruneKeep, a tier always keeps the most recent entry, even with keep 0
+	for (keeptier &t : this->tiers)
+		t.keep = std::max<size_t>(t.keep, 1);
+}
+
+void StreamingPruner::Add(timekey key, std::string_view name)
+{
+	switch (dir) {
+	case UNKNOWN:
+		if (!started) {
+			// Whichever way the input goes, the first entry is kept for now.
+			started = true;
+			first = last = key;
+			first_name = name;
+			return;
+		}
+		if (key == first) {
+			// A tie with the first entry never starts a new bucket, in either direction.
+			prune(name);
+			return;
+		}
+		if (key > first) {
+			StartAscending();
+			AddAscending(key, name);
+			return;
+		}
+		StartDescending();
+		break;
+	case DESCENDING:
+		if (key > last)
+			throw std::runtime_error(string("input is not sorted: ") + string(name));
+		break;
+	case ASCENDING:
+		AddAscending(key, name);
+		return;
+	}
+
+	// Descending input is the order FindPruneKeep walks in, so decisions are final right away.
+	last = key;
+	bool kept = false;
+	for (size_t t = 0; t < tiers.size(); t++) {
+		if (remaining[t] == 0)
+			continue;
+		int64_t id = BucketId(key, tiers[t].bucket);
+		if (id == current[t])
+			continue;
+		current[t] = id;
+		remaining[t]--;
+		kept = true;
+	}
+	if (!kept)
+		prune(name);
+}
+
+void StreamingPruner::StartDescending()
+{
+	dir = DESCENDING;
+	first_name.clear();
+	for (keeptier const& t : tiers) {
+		current.push_back(BucketId(first, t.bucket));
+		remaining.push_back(t.keep - 1);
+	}
+}
+
+void StreamingPruner::StartAscending()
+{
+	dir = ASCENDING;
+	// The first entry is the head of the oldest bucket of every tier, and the newest so far.
+	size_t id = NewCandidate(first, first_name, tiers.size() + 1);
+	first_name.clear();
+	newest = id;
+	for (keeptier const& t : tiers)
+		heads.push_back(tierheads{ t, std::deque<size_t>(1, id) });
+}
+
+void StreamingPruner::AddAscending(timekey key, std::string_view name)
+{
+	candidate const& prev = pool[newest];
+	if (key < prev.key)
+		throw std::runtime_error(string("input is not sorted: ") + string(name));
+	// Ties keep the entry that came first, which also means they are never referenced.
+	if (key == prev.key) {
+		prune(name);
+		return;
+	}
+
+	size_t id = NewCandidate(key, name, 1);
+	size_t old_newest = newest;
+	newest = id;
+	for (tierheads &h : heads) {
+		size_t head = h.heads.back();
+		pool[id].refs++;
+		if (BucketId(pool[head].key, h.tier.bucket) == BucketId(key, h.tier.bucket)) {
+			// Same bucket, the more recent entry takes over
+			h.heads.back() = id;
+			Release(head);
+			continue;
+		}
+		h.heads.push_back(id);
+		if (h.heads.size() > h.tier.keep) {
+			size_t oldest = h.heads.front();
+			h.heads.pop_front();
+			Release(oldest);
+		}
+	}
+	Release(old_newest);
+}
+
+size_t StreamingPruner::NewCandidate(timekey key, std::string_view name, size_t refs)
+{
+	size_t id;
+	if (free_ids.empty()) {
+		id = pool.size();
+		pool.push_back(candidate{ key, string(name), refs });
+	}
+	else {
+		id = free_ids.back();
+		free_ids.pop_back();
+		pool[id].key = key;
+		pool[id].name.assign(name.data(), name.size());
+		pool[id].refs = refs;
+	}
+	return id;
+}
+
+void StreamingPruner::Release(size_t id)
+{
+	if (--pool[id].refs > 0)
+		return;
+	prune(pool[id].name);
+	free_ids.push_back(id);
+}
+
+RetentionIndex::RetentionIndex(vector<keeptier> const& tiers, prune_fn prune)
+	: tiers(tiers),
+	prune(std::move(prune)),
+	changed(false)
+{
+}
+
+void RetentionIndex::Insert(timekey key, std::string_view name)
+{
+	auto inserted = names.emplace(name);
+	if (!inserted.second)
+		return;
+	entries.push_back(entry{ key, string(name) });
+	changed = true;
+}
+
+void RetentionIndex::Erase(std::string_view name)
+{
+	if (names.erase(string(name)) == 0)
+		return;
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (entries[i].name == name) {
+			entries.erase(entries.begin() + i);
+			break;
+		}
+	}
+	changed = true;
+}
+
+void RetentionIndex::Clear()
+{
+	entries.clear();
+	names.clear();
+	changed = false;
+}
+
+void RetentionIndex::Update()
+{
+	if (!changed)
+		return;
+	changed = false;
+	if (entries.empty())
+		return;
+
+	// Stable, so among equal times the kept entries stay ahead of new ones
+	vector<keyentry> times(entries.size());
+	for (size_t i = 0; i < entries.size(); i++)
+		times[i] = keyentry{ entries[i].key, i };
+	RadixSortDescending(times);
+
+	Bitmap keep(times.size());
+	FindPruneKeep(times, tiers, keep);
+
+	vector<entry> kept;
+	for (size_t i = 0; i < times.size(); i++) {
+		entry &e = entries[times[i].offset];
+		if (keep.Test(i))
+			kept.push_back(std::move(e));
+		else {
+			prune(e.name);
+			names.erase(e.name);
+		}
+	}
+	entries = std::move(kept);
+}
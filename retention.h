@@ -0,0 +1,162 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include "bucket.h"
+#include "timekey.h"
+
+
+/* One bit per entry of a sorted listing.
+ */
+class Bitmap {
+public:
+	explicit Bitmap(size_t size) : words((size + 63) / 64, 0) {}
+
+	void Set(size_t i) { words[i / 64] |= uint64_t(1) << (i % 64); }
+	bool Test(size_t i) const { return (words[i / 64] >> (i % 64)) & 1; }
+
+private:
+	std::vector<uint64_t> words;
+};
+
+/* A --keep-* option: keep the most recent entry of each of the newest `keep` buckets, where two
+ * times share a bucket if they have the same BucketId().
+ */
+struct keeptier {
+	size_t keep;
+	bucketing bucket;
+};
+
+/* Marks the entries of times (sorted most recent first) that have to be kept. The most recent
+ * entry is always kept, every tier is evaluated during the same walk over times.
+ */
+void FindPruneKeep(std::vector<keyentry> const& times, std::vector<keeptier> const& tiers,
+		Bitmap &keep);
+
+/* The indices of the entries FindPruneKeep would mark in times (sorted most recent first), in
+ * ascending order. Instead of walking times, the start of each next bucket is found with a binary
+ * search, so this takes O(kept * log n), which makes evaluating many policies against the same
+ * listing cheap.
+ */
+std::vector<size_t> FindKeptEntries(std::vector<keyentry> const& times,
+		std::vector<keeptier> const& tiers);
+
+/* FindPruneKeep for times in any order, with keep indexed like times. Marks the same entries as
+ * FindPruneKeep would over a stable most recent first sort of times, but without sorting: each
+ * tier picks out its newest buckets and their most recent entries in a single pass.
+ */
+void FindPruneKeepUnsorted(std::vector<keyentry> const& times, std::vector<keeptier> const& tiers,
+		Bitmap &keep);
+
+/* Retention for a listing that arrives already sorted, either most recent first or oldest first.
+ * The direction is picked up from the input. Entries are fed in one at a time and every prune
+ * decision is handed to the prune callback as soon as it is final, so memory only grows with the
+ * number of entries that may still be kept. Decisions are the same as FindPruneKeep would make,
+ * ties between equal times resolved in favour of the one that came first.
+ */
+class StreamingPruner {
+public:
+	typedef std::function<void(std::string_view)> prune_fn;
+
+	StreamingPruner(std::vector<keeptier> const& tiers, prune_fn prune);
+
+	// Throws std::runtime_error if key is out of order with what came before.
+	void Add(timekey key, std::string_view name);
+
+private:
+	enum direction { UNKNOWN, DESCENDING, ASCENDING };
+
+	// An entry that is still referenced by at least one tier while the input is ascending
+	struct candidate {
+		timekey key;
+		std::string name;
+		size_t refs;
+	};
+	// Ascending state of one tier: the most recent entry of each of the newest buckets
+	struct tierheads {
+		keeptier tier;
+		std::deque<size_t> heads;
+	};
+
+	void StartDescending();
+	void StartAscending();
+	void AddAscending(timekey key, std::string_view name);
+	size_t NewCandidate(timekey key, std::string_view name, size_t refs);
+	void Release(size_t id);
+
+	std::vector<keeptier> tiers;
+	prune_fn prune;
+	direction dir;
+	bool started;
+	timekey first;
+	timekey last;
+	std::string first_name;
+
+	// DESCENDING: last kept bucket and remaining buckets per tier, as in FindPruneKeep
+	std::vector<int64_t> current;
+	std::vector<size_t> remaining;
+
+	// ASCENDING
+	std::vector<candidate> pool;
+	std::vector<size_t> free_ids;
+	std::vector<tierheads> heads;
+	size_t newest;
+};
+
+/* Retention for a set of entries that changes over time, arriving in any order. Only the entries
+ * that are kept are remembered: once something is pruned, newer arrivals can never make it kept
+ * again, so the kept set plus whatever is new is all Update() needs.
+ */
+class RetentionIndex {
+public:
+	typedef std::function<void(std::string_view)> prune_fn;
+
+	RetentionIndex(std::vector<keeptier> const& tiers, prune_fn prune);
+
+	// Queues an entry for the next Update(). Names that are already known are ignored.
+	void Insert(timekey key, std::string_view name);
+	// Forgets an entry that no longer exists, without pruning it.
+	void Erase(std::string_view name);
+	// Forgets everything, e.g. before starting over from a full listing.
+	void Clear();
+	/* Applies everything inserted or erased since the last call and hands what is no longer kept
+	 * to prune. Ties between equal times are resolved in favour of the entry known the longest.
+	 */
+	void Update();
+
+	size_t Size() const { return entries.size(); }
+
+private:
+	struct entry {
+		timekey key;
+		std::string name;
+	};
+
+	std::vector<keeptier> tiers;
+	prune_fn prune;
+	// Kept entries most recent first, followed by the ones inserted since the last Update()
+	std::vector<entry> entries;
+	std::unordered_set<std::string> names;
+	bool changed;
+};
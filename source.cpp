@@ -0,0 +1,267 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "source.h"
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "parallel.h"
+
+using std::string;
+using std::vector;
+
+
+FdSource::FdSource(int fd, size_t page_size)
+	: fd(fd),
+	page_size(page_size)
+{
+}
+
+bool FdSource::Fetch(string &page)
+{
+	size_t start = page.size();
+	page.resize(start + page_size);
+	size_t got = 0;
+	// Fill the whole page if the data is there, pipes hand out much less per read
+	while (got < page_size) {
+		ssize_t n = read(fd, &page[start + got], page_size - got);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			page.resize(start + got);
+			throw std::system_error(errno, std::generic_category(), "failed to read input");
+		}
+		if (n == 0)
+			break;
+		got += n;
+	}
+	page.resize(start + got);
+	return got > 0;
+}
+
+static int StartCommand(string const& command, pid_t &pid)
+{
+	int fds[2];
+	if (pipe2(fds, O_CLOEXEC) != 0)
+		throw std::system_error(errno, std::generic_category(), "failed to create a pipe");
+	pid = fork();
+	if (pid == 0) {
+		dup2(fds[1], STDOUT_FILENO);
+		execl("/bin/sh", "sh", "-c", command.c_str(), static_cast<char *>(nullptr));
+		_exit(127);
+	}
+	int err = errno;
+	close(fds[1]);
+	if (pid < 0) {
+		close(fds[0]);
+		throw std::system_error(err, std::generic_category(), "failed to run '" + command + "'");
+	}
+	return fds[0];
+}
+
+CommandSource::CommandSource(string const& command)
+	: command(command),
+	fd(StartCommand(command, pid)),
+	reader(fd)
+{
+}
+
+CommandSource::~CommandSource()
+{
+	if (fd >= 0)
+		close(fd);
+	if (pid > 0) {
+		// Given up on early, it gets SIGPIPE if it writes any more
+		int status;
+		while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+			;
+	}
+}
+
+bool CommandSource::Fetch(string &page)
+{
+	if (pid <= 0)
+		return false;
+	if (reader.Fetch(page))
+		return true;
+	Wait();
+	return false;
+}
+
+void CommandSource::Wait()
+{
+	close(fd);
+	fd = -1;
+	int status;
+	pid_t done;
+	do
+		done = waitpid(pid, &status, 0);
+	while (done < 0 && errno == EINTR);
+	pid = -1;
+	if (done < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		throw std::runtime_error("'" + command + "' failed");
+}
+
+
+// Pages fetched ahead of the parser, at most
+static const size_t PAGES_AHEAD = 8;
+
+namespace {
+/* Pages handed from the fetch thread to the parser. Every page ends on a line boundary, except
+ * maybe the very last one.
+ */
+class PageQueue {
+public:
+	// Returns false once the parser has stopped taking pages.
+	bool Push(string page)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		has_room.wait(guard, [this]() { return pages.size() < PAGES_AHEAD || closed; });
+		if (closed)
+			return false;
+		pages.push_back(std::move(page));
+		has_page.notify_one();
+		return true;
+	}
+
+	// Called by the fetch thread when it's done, with whatever went wrong
+	void End(std::exception_ptr error)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		failure = error;
+		ended = true;
+		has_page.notify_one();
+	}
+
+	// Returns false at the end. Rethrows what the fetch thread failed with.
+	bool Pop(string &page)
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		has_page.wait(guard, [this]() { return !pages.empty() || ended; });
+		if (pages.empty()) {
+			if (failure)
+				std::rethrow_exception(failure);
+			return false;
+		}
+		page = std::move(pages.front());
+		pages.pop_front();
+		has_room.notify_one();
+		return true;
+	}
+
+	// Lets the fetch thread go when the parser stops early
+	void Close()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		closed = true;
+		has_room.notify_one();
+	}
+
+private:
+	std::mutex lock;
+	std::condition_variable has_room;
+	std::condition_variable has_page;
+	std::deque<string> pages;
+	std::exception_ptr failure;
+	bool ended = false;
+	bool closed = false;
+};
+}
+
+// Fetches every page from source into queue, cut on line boundaries
+static void FetchPages(InputSource &source, char delim, PageQueue &queue)
+{
+	try {
+		string rest;
+		for (;;) {
+			string page = std::move(rest);
+			rest.clear();
+			bool more = source.Fetch(page);
+			if (more) {
+				size_t cut = page.rfind(delim);
+				if (cut == string::npos) {
+					// No complete line yet
+					rest = std::move(page);
+					continue;
+				}
+				rest.assign(page, cut + 1, string::npos);
+				page.resize(cut + 1);
+			}
+			if (!page.empty() && !queue.Push(std::move(page)))
+				break;
+			if (!more)
+				break;
+		}
+		queue.End(nullptr);
+	}
+	catch (...) {
+		queue.End(std::current_exception());
+	}
+}
+
+vector<keyentry> ParsePagedListing(LineParser const& parser, InputSource &source, char delim,
+		bool sorted, string &data, std::ostream &warn, parsestats *stats)
+{
+	PageQueue queue;
+	std::thread fetcher(FetchPages, std::ref(source), delim, std::ref(queue));
+	vector<vector<keyentry>> runs;
+	data.clear();
+	try {
+		string page;
+		while (queue.Pop(page)) {
+			vector<keyentry> run;
+			parser.ParseAll(page, delim, page.data(), run, warn, stats);
+			// Offsets are relative to the page so far, the page goes to the end of data
+			for (keyentry &e : run)
+				e.offset += data.size();
+			if (sorted) {
+				std::chrono::steady_clock::time_point start;
+				if (stats && stats->timed)
+					start = std::chrono::steady_clock::now();
+				RadixSortDescending(run);
+				if (stats && stats->timed) {
+					stats->sort += std::chrono::duration<double>(
+							std::chrono::steady_clock::now() - start).count();
+				}
+			}
+			data += page;
+			runs.push_back(std::move(run));
+		}
+	}
+	catch (...) {
+		queue.Close();
+		fetcher.join();
+		throw;
+	}
+	fetcher.join();
+
+	if (sorted)
+		return MergeDescending(runs, 1);
+	vector<keyentry> entries;
+	for (vector<keyentry> &run : runs)
+		entries.insert(entries.end(), run.begin(), run.end());
+	return entries;
+}
@@ -0,0 +1,83 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+
+#include "prune.h"
+#include "timekey.h"
+
+
+/* Where a --prune listing comes from, when it arrives a page at a time (a pipe, a tool listing
+ * an object store) rather than all at once.
+ */
+class InputSource {
+public:
+	virtual ~InputSource() =default;
+
+	/* Appends the next page of the listing to page, which may end in the middle of a line.
+	 * Returns false once there is nothing left. Throws std::runtime_error on failure.
+	 */
+	virtual bool Fetch(std::string &page) =0;
+};
+
+// Reads pages from fd, which is not closed.
+class FdSource : public InputSource {
+public:
+	explicit FdSource(int fd, size_t page_size = 1 << 20);
+
+	bool Fetch(std::string &page) override;
+
+private:
+	int fd;
+	size_t page_size;
+};
+
+/* Runs command through /bin/sh and reads its output. Fetch() throws std::runtime_error at the end
+ * of the output if the command failed.
+ */
+class CommandSource : public InputSource {
+public:
+	// Throws std::system_error if the command can't be started.
+	explicit CommandSource(std::string const& command);
+	~CommandSource() override;
+
+	CommandSource(CommandSource const&) =delete;
+	CommandSource& operator=(CommandSource const&) =delete;
+
+	bool Fetch(std::string &page) override;
+
+private:
+	void Wait();
+
+	std::string command;
+	int fd;
+	pid_t pid;
+	FdSource reader;
+};
+
+/* ParseListing for a listing from source, parsed while further pages are still being fetched: a
+ * thread fetches pages, the calling one parses (and with sorted, sorts) each one as soon as it
+ * is in. The listing ends up in data, which the offsets of the entries refer to. Entries are
+ * most recent first with sorted, in input order otherwise. Warnings go to warn in input order.
+ */
+std::vector<keyentry> ParsePagedListing(LineParser const& parser, InputSource &source,
+		char delim, bool sorted, std::string &data, std::ostream &warn = std::cerr,
+		parsestats *stats = nullptr);
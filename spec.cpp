@@ -0,0 +1,173 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "spec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+using std::string;
+
+
+static const char NOW_TOKEN[] = "{now";
+static const size_t NOW_TOKEN_LENGTH = sizeof(NOW_TOKEN) - 1;
+
+CompiledSpec::CompiledSpec(string const& spec)
+{
+	size_t name_i = 0;
+	size_t literal_start = 0;
+	for (size_t pos = spec.find(NOW_TOKEN); ; pos = spec.find(NOW_TOKEN, pos + 1)) {
+		// "{now}" or "{now:fmt}", anything else that starts with "{now" is literal text
+		nowformat const* format = nullptr;
+		size_t token_end = 0;
+		if (pos != string::npos) {
+			size_t after = pos + NOW_TOKEN_LENGTH;
+			if (after < spec.size() && spec[after] == '}') {
+				format = &DefaultNowFormat();
+				token_end = after + 1;
+			}
+			else if (after < spec.size() && spec[after] == ':') {
+				size_t close = spec.find('}', after);
+				if (close == string::npos)
+					throw std::invalid_argument("unterminated {now: in spec '" + spec + "'");
+				string name = spec.substr(after + 1, close - after - 1);
+				format = FindNowFormat(name);
+				if (!format) {
+					throw std::invalid_argument("unknown {now} format '" + name +
+							"', expected one of " + NowFormatNames());
+				}
+				token_end = close + 1;
+			}
+			else
+				continue;
+		}
+
+		size_t end = pos == string::npos ? spec.size() : pos;
+		if (end > literal_start) {
+			literals.push_back(literal{ name_i, spec.substr(literal_start, end - literal_start) });
+			name_i += end - literal_start;
+		}
+		if (pos == string::npos)
+			break;
+		slots.push_back(slot{ name_i, format });
+		name_i += format->width;
+		literal_start = token_end;
+		pos = token_end - 1;
+	}
+	name_len = name_i;
+}
+
+bool CompiledSpec::Matches(std::string_view line) const
+{
+	// Wrong length names are by far the most common mismatch
+	if (line.size() != name_len)
+		return false;
+	for (literal const& l : literals) {
+		if (std::memcmp(line.data() + l.name_offset, l.text.data(), l.text.size()) != 0)
+			return false;
+	}
+	return true;
+}
+
+bool CompiledSpec::ParseNow(std::string_view line, timekey &key) const
+{
+	char const* now = line.data() + slots[0].name_offset;
+	bool valid;
+	slots[0].format->parse(&now, 1, &key, &valid);
+	return valid;
+}
+
+template <class Put>
+void CompiledSpec::Emit(timestruct const& now, Put put) const
+{
+	// Specs nearly always use one format throughout, so it is only formatted again if that changes
+	char now_str[100];
+	size_t now_len = 0;
+	nowformat const* formatted = nullptr;
+	size_t lit = 0;
+	for (size_t n = 0; n <= slots.size(); n++) {
+		// Literals that come before the next {now} (or the end)
+		size_t until = n < slots.size() ? slots[n].name_offset : name_len;
+		while (lit < literals.size() && literals[lit].name_offset < until) {
+			put(literals[lit].text.data(), literals[lit].text.size());
+			lit++;
+		}
+		if (n < slots.size()) {
+			if (slots[n].format != formatted) {
+				formatted = slots[n].format;
+				now_len = formatted->format(now, now_str);
+			}
+			put(now_str, now_len);
+		}
+	}
+}
+
+string CompiledSpec::Format(timestruct const& now) const
+{
+	string out;
+	out.reserve(name_len);
+	Emit(now, [&out](char const* text, size_t len) { out.append(text, len); });
+	return out;
+}
+
+size_t CompiledSpec::FormatTo(timestruct const& now, char *out, size_t size) const
+{
+	size_t len = 0;
+	Emit(now, [&](char const* text, size_t n) {
+		if (len + n < size)
+			std::memcpy(out + len, text, n);
+		len += n;
+	});
+	if (len < size)
+		out[len] = '\0';
+	return len;
+}
+
+SpecSet::SpecSet(std::vector<CompiledSpec> specs_)
+	: specs(std::move(specs_))
+{
+	// The prefixes point into specs, which doesn't change from here on
+	for (size_t i = 0; i < specs.size(); i++) {
+		std::string_view prefix = specs[i].Prefix();
+		std::vector<size_t> &ids = by_prefix[prefix];
+		if (ids.empty())
+			prefix_lengths.push_back(prefix.size());
+		ids.push_back(i);
+	}
+	std::sort(prefix_lengths.begin(), prefix_lengths.end());
+	prefix_lengths.erase(std::unique(prefix_lengths.begin(), prefix_lengths.end()),
+			prefix_lengths.end());
+}
+
+size_t SpecSet::Find(std::string_view line) const
+{
+	size_t found = npos;
+	for (size_t len : prefix_lengths) {
+		if (len > line.size())
+			break;
+		auto it = by_prefix.find(line.substr(0, len));
+		if (it == by_prefix.end())
+			continue;
+		for (size_t i : it->second) {
+			if (i >= found)
+				break;
+			if (specs[i].Matches(line)) {
+				found = i;
+				break;
+			}
+		}
+	}
+	return found;
+}
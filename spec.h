@@ -0,0 +1,112 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "nowformat.h"
+#include "timestruct.h"
+
+
+/* A <spec> broken down once into its literal text and {now} slots. The same program is used to
+ * recognise names in a --prune list and to generate new names. A slot is either {now} or
+ * {now:fmt} with one of the formats in nowformat.h.
+ */
+class CompiledSpec {
+public:
+	// Throws std::invalid_argument for a {now:fmt} that isn't a known format
+	explicit CompiledSpec(std::string const& spec);
+
+	// Every name the spec matches has exactly this length
+	size_t NameLength() const { return name_len; }
+	size_t NowCount() const { return slots.size(); }
+
+	bool Matches(std::string_view line) const;
+	// The first {now} of a line that Matches(), which is the one used as its timestamp
+	std::string_view Now(std::string_view line) const
+	{
+		return line.substr(slots[0].name_offset, slots[0].format->width);
+	}
+	// The format of that first {now}
+	nowformat const& NowFormat() const { return *slots[0].format; }
+	// Parses Now(line) into key, false if it isn't a valid time.
+	bool ParseNow(std::string_view line, timekey &key) const;
+
+	// Fills every {now} with now.
+	std::string Format(timestruct const& now) const;
+	/* Format() into out, like snprintf: returns the length of the name, which out only holds
+	 * in full (and terminated) if that is less than size. Nothing is allocated either way.
+	 */
+	size_t FormatTo(timestruct const& now, char *out, size_t size) const;
+
+	// The literal text every matching name starts with, empty if the spec starts with {now}
+	std::string_view Prefix() const
+	{
+		if (literals.empty() || literals[0].name_offset != 0)
+			return std::string_view();
+		return literals[0].text;
+	}
+
+private:
+	// Literal text of the spec, and where it sits in a matching name
+	struct literal {
+		size_t name_offset;
+		std::string text;
+	};
+
+	// A {now} and where it sits in a matching name
+	struct slot {
+		size_t name_offset;
+		nowformat const* format;
+	};
+
+	// Calls put(text, len) with each piece of the name for now, in order
+	template <class Put>
+	void Emit(timestruct const& now, Put put) const;
+
+	std::vector<literal> literals;
+	std::vector<slot> slots;
+	size_t name_len;
+};
+
+/* Several specs that a listing is split between. Names are sent to a spec by hashing their
+ * first literal segment, so only the specs that share a prefix with the name are tried.
+ */
+class SpecSet {
+public:
+	static const size_t npos = size_t(-1);
+
+	explicit SpecSet(std::vector<CompiledSpec> specs);
+	// by_prefix points into specs, which survives a move but not a copy
+	SpecSet(SpecSet const&) =delete;
+	SpecSet& operator=(SpecSet const&) =delete;
+	SpecSet(SpecSet&&) =default;
+
+	size_t Size() const { return specs.size(); }
+	CompiledSpec const& operator[](size_t i) const { return specs[i]; }
+
+	// The first spec, in the order given, that matches line. npos if there is none.
+	size_t Find(std::string_view line) const;
+
+private:
+	std::vector<CompiledSpec> specs;
+	// Distinct prefix lengths, and the specs with each prefix in order
+	std::vector<size_t> prefix_lengths;
+	std::unordered_map<std::string_view, std::vector<size_t>> by_prefix;
+};
@@ -0,0 +1,192 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "state.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "output.h"
+
+using std::string;
+
+
+static char const STATE_MAGIC[8] = { 'F', 'T', 'G', 'S', 'T', 'A', 'T', 'E' };
+static const uint32_t STATE_VERSION = 2;
+// Where the seconds were in a version 1 key
+static const int V1_SEC_SHIFT = 6;
+
+struct stateheader {
+	char magic[8];
+	uint32_t version;
+	uint32_t spec_len;
+	uint64_t count;
+	uint64_t name_len;
+};
+static_assert(sizeof(stateheader) == 32, "state header has no padding");
+
+static size_t Pad8(size_t n)
+{
+	return (n + 7) & ~size_t(7);
+}
+
+RetentionState::RetentionState(string const& path, string const& spec, size_t name_len)
+	: keys(nullptr),
+	names(nullptr),
+	count(0),
+	name_len(name_len),
+	legacy_keys(false)
+{
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0 && errno == ENOENT)
+		return;
+	file = std::make_unique<InputBuffer>(path);
+	std::string_view data = file->Data();
+
+	string corrupt = "state file '" + path + "' is damaged";
+	stateheader header;
+	if (data.size() < sizeof(header))
+		throw std::runtime_error(corrupt);
+	std::memcpy(&header, data.data(), sizeof(header));
+	if (std::memcmp(header.magic, STATE_MAGIC, sizeof(STATE_MAGIC)) != 0)
+		throw std::runtime_error("'" + path + "' is not a state file");
+	if (header.version == 1)
+		legacy_keys = true;
+	else if (header.version != STATE_VERSION)
+		throw std::runtime_error("state file '" + path + "' has unsupported version "
+				+ std::to_string(header.version));
+
+	size_t spec_at = sizeof(header);
+	if (data.size() - spec_at < header.spec_len)
+		throw std::runtime_error(corrupt);
+	if (data.substr(spec_at, header.spec_len) != spec || header.name_len != name_len)
+		throw std::runtime_error("state file '" + path + "' was written for spec '"
+				+ string(data.substr(spec_at, header.spec_len)) + "'");
+
+	size_t keys_at = spec_at + Pad8(header.spec_len);
+	size_t names_at = keys_at + header.count * sizeof(timekey);
+	if (header.count > data.size() / (sizeof(timekey) + (name_len ? name_len : 1))
+			|| names_at + header.count * name_len != data.size())
+		throw std::runtime_error(corrupt);
+
+	keys = data.data() + keys_at;
+	names = data.data() + names_at;
+	count = header.count;
+}
+
+timekey RetentionState::Key(size_t i) const
+{
+	timekey key;
+	std::memcpy(&key, keys + i * sizeof(timekey), sizeof(key));
+	if (legacy_keys) {
+		/* Version 1 keys had the seconds at bit 6 and no milliseconds. Before tiers were bucketed
+		 * by ID, the bits below the seconds held the week, so they are dropped, not shifted.
+		 */
+		return (key >> V1_SEC_SHIFT) << KEY_SEC_SHIFT;
+	}
+	return key;
+}
+
+std::string_view RetentionState::Name(size_t i) const
+{
+	return std::string_view(names + i * name_len, name_len);
+}
+
+void WriteRetentionState(string const& path, string const& spec, size_t name_len,
+		std::vector<keyentry> const& times, Bitmap const& keep, std::string_view data)
+{
+	stateheader header;
+	std::memcpy(header.magic, STATE_MAGIC, sizeof(STATE_MAGIC));
+	header.version = STATE_VERSION;
+	header.spec_len = uint32_t(spec.size());
+	header.count = 0;
+	header.name_len = name_len;
+	for (size_t i = 0; i < times.size(); i++)
+		header.count += keep.Test(i);
+
+	string out(reinterpret_cast<char const*>(&header), sizeof(header));
+	out += spec;
+	out.resize(Pad8(out.size()), '\0');
+	for (size_t i = 0; i < times.size(); i++) {
+		if (keep.Test(i))
+			out.append(reinterpret_cast<char const*>(&times[i].key), sizeof(timekey));
+	}
+	for (size_t i = 0; i < times.size(); i++) {
+		if (keep.Test(i))
+			out.append(data.substr(times[i].offset, name_len));
+	}
+
+	string tmp = path + ".tmp";
+	int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		throw std::system_error(errno, std::generic_category(),
+				"failed to write state '" + tmp + "'");
+	try {
+		WriteAll(fd, out.data(), out.size());
+		if (fsync(fd) != 0)
+			throw std::system_error(errno, std::generic_category(),
+					"failed to write state '" + tmp + "'");
+	}
+	catch (...) {
+		close(fd);
+		unlink(tmp.c_str());
+		throw;
+	}
+	close(fd);
+	if (rename(tmp.c_str(), path.c_str()) != 0) {
+		int err = errno;
+		unlink(tmp.c_str());
+		throw std::system_error(err, std::generic_category(), "failed to replace state '" + path + "'");
+	}
+}
+
+std::vector<keyentry> MergeRetentionState(RetentionState const& state,
+		std::vector<keyentry> const& fresh, std::string_view data,
+		std::unordered_set<std::string_view> const& removed, string &names)
+{
+	size_t name_len = state.NameLength();
+	names.reserve((state.Size() + fresh.size()) * name_len);
+	std::unordered_set<std::string_view> known;
+	std::vector<keyentry> kept;
+	for (size_t i = 0; i < state.Size(); i++) {
+		std::string_view name = state.Name(i);
+		if (removed.count(name))
+			continue;
+		known.insert(name);
+		kept.push_back(keyentry{ state.Key(i), names.size() });
+		names.append(name);
+	}
+	std::vector<keyentry> added;
+	for (keyentry const& entry : fresh) {
+		std::string_view name = data.substr(entry.offset, name_len);
+		if (known.count(name))
+			continue;
+		added.push_back(keyentry{ entry.key, names.size() });
+		names.append(name);
+	}
+
+	// Both are most recent first already, ties go to the older run
+	std::vector<keyentry> merged(kept.size() + added.size());
+	std::merge(kept.begin(), kept.end(), added.begin(), added.end(), merged.begin(),
+			[](keyentry const& lhs, keyentry const& rhs) { return lhs.key > rhs.key; });
+	return merged;
+}
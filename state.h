@@ -0,0 +1,72 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include "input.h"
+#include "retention.h"
+#include "timekey.h"
+
+
+/* What a --state file remembers between runs: the entries that were kept last time, most recent
+ * first. Entries that weren't kept can never be kept again once newer ones show up, so they're
+ * all a later run needs to reach the same decisions as one over the full history. The bucket heads
+ * of every tier are among them, and are found again with a single FindPruneKeep walk.
+ *
+ * Layout, native byte order: "FTGSTATE", u32 version, u32 spec length, u64 entry count,
+ * u64 name length, the spec padded to 8 bytes, the packed keys, then the names back to back.
+ */
+class RetentionState {
+public:
+	/* Maps the state at path. A missing file is an empty state. Throws std::runtime_error if the
+	 * file is damaged or was written for a different spec.
+	 */
+	RetentionState(std::string const& path, std::string const& spec, size_t name_len);
+
+	size_t Size() const { return count; }
+	timekey Key(size_t i) const;
+	std::string_view Name(size_t i) const;
+	size_t NameLength() const { return name_len; }
+
+private:
+	std::unique_ptr<InputBuffer> file;
+	char const* keys;
+	char const* names;
+	size_t count;
+	size_t name_len;
+	// Version 1 keys, which need converting to the current layout
+	bool legacy_keys;
+};
+
+/* Replaces the state at path with the entries of times that keep has. The new file is written
+ * next to it and renamed over it, so a failed run leaves the old state in place.
+ * Throws std::system_error on failure.
+ */
+void WriteRetentionState(std::string const& path, std::string const& spec, size_t name_len,
+		std::vector<keyentry> const& times, Bitmap const& keep, std::string_view data);
+
+/* Combines the entries kept in state with fresh ones parsed from data, both most recent first.
+ * Names that state already has or that are in removed are dropped. The names of the result are
+ * copied to names, which is what its offsets point into.
+ */
+std::vector<keyentry> MergeRetentionState(RetentionState const& state,
+		std::vector<keyentry> const& fresh, std::string_view data,
+		std::unordered_set<std::string_view> const& removed, std::string &names);
@@ -0,0 +1,130 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "stats.h"
+
+#include <cstdio>
+#include <unordered_set>
+
+#include <sys/resource.h>
+
+using std::string;
+using std::vector;
+
+
+double SecondsSince(RunStats::clock::time_point start)
+{
+	return std::chrono::duration<double>(RunStats::clock::now() - start).count();
+}
+
+RunStats::RunStats(bool enabled)
+	: enabled(enabled),
+	last(enabled ? clock::now() : clock::time_point())
+{
+	parse.timed = enabled;
+}
+
+void RunStats::Lap(char const* name)
+{
+	if (!enabled)
+		return;
+	clock::time_point now = clock::now();
+	phases.emplace_back(name, std::chrono::duration<double>(now - last).count());
+	last = now;
+}
+
+void RunStats::CountTiers(vector<keyentry> const& times, vector<keeptier> const& tierlist)
+{
+	if (!enabled || times.empty())
+		return;
+	// A tier keeps one entry per bucket, up to keep of them, whatever order times are in
+	for (keeptier const& t : tierlist) {
+		std::unordered_set<int64_t> buckets;
+		for (size_t i = 0; i < times.size() && buckets.size() < t.keep; i++)
+			buckets.insert(BucketId(times[i].key, t.bucket));
+		tiers.emplace_back(t, buckets.size());
+	}
+}
+
+static string TierName(keeptier const& t)
+{
+	static char const* const names[] = {
+		"minutely", "hourly", "daily", "weekly", "monthly", "quarterly", "yearly",
+	};
+	if (t.bucket.unit == BUCKET_MINUTES)
+		return "every " + std::to_string(t.bucket.width) + "m";
+	return names[t.bucket.unit];
+}
+
+static long PeakRssKiB()
+{
+	rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+	return usage.ru_maxrss;
+}
+
+void RunStats::Report(std::ostream &out, bool json) const
+{
+	if (!enabled)
+		return;
+	char buf[256];
+	// Thread time spent inside the parse phase, on top of the wall clock phases
+	vector<std::pair<char const*, double>> detail = {
+		{ "validate", parse.validate }, { "timestamp", parse.parse }, { "sort", parse.sort },
+	};
+	size_t rejected = parse.spec_mismatch + parse.bad_time;
+
+	if (!json) {
+		for (auto const& p : phases) {
+			std::snprintf(buf, sizeof(buf), "stats: %-12s %10.3f ms\n", p.first, p.second * 1e3);
+			out << buf;
+		}
+		for (auto const& p : detail) {
+			std::snprintf(buf, sizeof(buf), "stats:   %-10s %10.3f ms\n", p.first, p.second * 1e3);
+			out << buf;
+		}
+		out << "stats: lines " << parse.lines << ", rejected " << rejected << " (spec "
+			<< parse.spec_mismatch << ", time " << parse.bad_time << "), kept " << kept
+			<< ", pruned " << pruned << "\n";
+		for (auto const& t : tiers) {
+			out << "stats: tier " << TierName(t.first) << " " << t.first.keep << ": kept "
+				<< t.second << "\n";
+		}
+		out << "stats: peak rss " << PeakRssKiB() << " KiB\n";
+		return;
+	}
+
+	out << "{\"phases\":{";
+	bool first = true;
+	for (auto const& p : phases) {
+		std::snprintf(buf, sizeof(buf), "%s\"%s\":%.6f", first ? "" : ",", p.first, p.second);
+		out << buf;
+		first = false;
+	}
+	out << "},\"parse_threads\":{";
+	for (size_t i = 0; i < detail.size(); i++) {
+		std::snprintf(buf, sizeof(buf), "%s\"%s\":%.6f", i ? "," : "", detail[i].first,
+				detail[i].second);
+		out << buf;
+	}
+	out << "},\"lines\":" << parse.lines << ",\"rejected_spec\":" << parse.spec_mismatch
+		<< ",\"rejected_time\":" << parse.bad_time << ",\"kept\":" << kept
+		<< ",\"pruned\":" << pruned << ",\"tiers\":[";
+	for (size_t i = 0; i < tiers.size(); i++) {
+		out << (i ? "," : "") << "{\"tier\":\"" << TierName(tiers[i].first) << "\",\"keep\":"
+			<< tiers[i].first.keep << ",\"kept\":" << tiers[i].second << "}";
+	}
+	out << "],\"peak_rss_kib\":" << PeakRssKiB() << "}\n";
+}
@@ -0,0 +1,56 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "prune.h"
+#include "retention.h"
+
+
+/* Phase timings and counters for --stats. Everything is a no-op unless enabled, so the calls can
+ * stay in the normal code path.
+ */
+class RunStats {
+public:
+	typedef std::chrono::steady_clock clock;
+
+	explicit RunStats(bool enabled);
+
+	bool Enabled() const { return enabled; }
+	// Records the time since the previous Lap() (or construction) as phase name.
+	void Lap(char const* name);
+	// Works out how many entries each tier kept.
+	void CountTiers(std::vector<keyentry> const& times, std::vector<keeptier> const& tiers);
+
+	parsestats parse;
+	size_t kept = 0;
+	size_t pruned = 0;
+
+	void Report(std::ostream &out, bool json) const;
+
+private:
+	bool enabled;
+	clock::time_point last;
+	std::vector<std::pair<char const*, double>> phases;
+	std::vector<std::pair<keeptier, size_t>> tiers;
+};
+
+double SecondsSince(RunStats::clock::time_point start);
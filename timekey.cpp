@@ -0,0 +1,72 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "timekey.h"
+
+#include <cstring>
+#include <utility>
+
+#include "civil.h"
+
+using std::vector;
+
+
+bool ParseTimeKey(std::string_view intime, timekey &key)
+{
+	int year, mon, mday, hour, min, sec;
+	if (!ParseNowSpec(intime, year, mon, mday, hour, min, sec))
+		return false;
+	key = PackTime(DaysFromCivilNorm(year, mon, mday) * 86400 + hour * 3600 + min * 60 + sec);
+	return true;
+}
+
+void RadixSortDescending(vector<keyentry> &entries)
+{
+	const size_t n = entries.size();
+	if (n < 2)
+		return;
+
+	// One histogram per key byte, all collected in a single pass.
+	static const int RADIX_BYTES = sizeof(timekey);
+	size_t counts[RADIX_BYTES * 256] = {};
+	for (keyentry const& e : entries) {
+		for (int b = 0; b < RADIX_BYTES; b++)
+			counts[b * 256 + ((e.key >> (b * 8)) & 0xff)]++;
+	}
+
+	vector<keyentry> scratch(n);
+	keyentry *src = entries.data();
+	keyentry *dst = scratch.data();
+	for (int b = 0; b < RADIX_BYTES; b++) {
+		size_t *count = &counts[b * 256];
+		// Most of the key bytes (year, often month) are the same for every entry. Those
+		// passes wouldn't move anything.
+		if (count[(src[0].key >> (b * 8)) & 0xff] == n)
+			continue;
+
+		// Descending order: the largest digit goes first.
+		size_t offsets[256];
+		size_t total = 0;
+		for (int d = 255; d >= 0; d--) {
+			offsets[d] = total;
+			total += count[d];
+		}
+		for (size_t i = 0; i < n; i++)
+			dst[offsets[(src[i].key >> (b * 8)) & 0xff]++] = src[i];
+		std::swap(src, dst);
+	}
+
+	if (src != entries.data())
+		std::memcpy(entries.data(), src, n * sizeof(keyentry));
+}
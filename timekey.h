@@ -0,0 +1,107 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+#include "civil.h"
+#include "timestruct.h"
+
+
+/* A parsed {now} packed into one integer. Fields are laid out from most to least significant, so
+ * comparing two keys compares the times, and the leading fields alone identify the minute, hour,
+ * day, month or year (see bucket.h).
+ *
+ *   bits 63-36  year + KEY_YEAR_BIAS
+ *   bits 35-32  mon  (1-12)
+ *   bits 31-27  mday (1-31)
+ *   bits 26-22  hour (0-23)
+ *   bits 21-16  min  (0-59)
+ *   bits 15-10  sec  (0-59)
+ *   bits 9-0    ms   (0-999), zero for {now} formats without them
+ *
+ * Fields are always normalized, "2020-01-01T10:75:00" is stored as 11:15.
+ */
+typedef uint64_t timekey;
+
+// Normalizing month 00 of year 0000 lands in year -1, keep that sortable.
+const int64_t KEY_YEAR_BIAS = 64;
+
+enum timekey_shift : int {
+	KEY_MS_SHIFT   = 0,
+	KEY_SEC_SHIFT  = 10,
+	KEY_MIN_SHIFT  = 16,
+	KEY_HOUR_SHIFT = 22,
+	KEY_MDAY_SHIFT = 27,
+	KEY_MON_SHIFT  = 32,
+	KEY_YEAR_SHIFT = 36,
+};
+
+enum timekey_field : uint64_t {
+	KEY_MS    = uint64_t(0x3ff) << KEY_MS_SHIFT,
+	KEY_SEC   = uint64_t(0x3f) << KEY_SEC_SHIFT,
+	KEY_MIN   = uint64_t(0x3f) << KEY_MIN_SHIFT,
+	KEY_HOUR  = uint64_t(0x1f) << KEY_HOUR_SHIFT,
+	KEY_MDAY  = uint64_t(0x1f) << KEY_MDAY_SHIFT,
+	KEY_MON   = uint64_t(0x0f) << KEY_MON_SHIFT,
+	KEY_YEAR  = uint64_t(0xfffffff) << KEY_YEAR_SHIFT,
+};
+
+// Packs fields that are already in range.
+constexpr timekey PackFields(int64_t year, int mon, int mday, int hour, int min, int sec, int ms = 0)
+{
+	return (uint64_t(year + KEY_YEAR_BIAS) << KEY_YEAR_SHIFT)
+		| (uint64_t(mon) << KEY_MON_SHIFT)
+		| (uint64_t(mday) << KEY_MDAY_SHIFT)
+		| (uint64_t(hour) << KEY_HOUR_SHIFT)
+		| (uint64_t(min) << KEY_MIN_SHIFT)
+		| (uint64_t(sec) << KEY_SEC_SHIFT)
+		| (uint64_t(ms) << KEY_MS_SHIFT);
+}
+
+// Packs seconds since 1970-01-01 in local time, plus ms milliseconds (0-999).
+constexpr timekey PackTime(int64_t local, int ms = 0)
+{
+	int64_t days = FloorDiv(local, 86400);
+	int64_t daysec = local - days * 86400;
+	civil_date date = CivilFromDays(days);
+	return PackFields(date.year, date.mon, date.mday, int(daysec / 3600), int(daysec / 60 % 60),
+			int(daysec % 60), ms);
+}
+
+/* Parses a {now} the same way timestruct(std::string_view) does, straight into a key. Returns
+ * false if intime is not in the right format.
+ */
+bool ParseTimeKey(std::string_view intime, timekey &key);
+
+/* ParseTimeKey for many {now} values at once, nows[i] pointing at NOW_SPEC_LENGTH bytes. valid[i]
+ * says whether nows[i] parsed, keys[i] is only set if it did. Uses AVX2, SSE4.1 or NEON when the
+ * CPU has them, picked the first time this is called.
+ */
+void ParseTimeKeys(char const* const* nows, size_t count, timekey *keys, bool *valid);
+
+/* One name from a --prune listing. The name itself stays in the input buffer, offset is where it
+ * starts.
+ */
+struct keyentry {
+	timekey key;
+	uint64_t offset;
+};
+
+// Sorts most recent first. Entries with equal keys keep their relative order.
+void RadixSortDescending(std::vector<keyentry> &entries);
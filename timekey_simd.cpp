@@ -0,0 +1,232 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "timekey.h"
+
+#include "civil.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define HAVE_NEON 1
+#endif
+
+
+/* Every kernel checks the layout and turns the digit pairs into numbers, the fields are then
+ * packed here. Fields that are already in range go straight into the key, anything else is
+ * normalized the same way ParseTimeKey does.
+ */
+static inline timekey PackParsed(int year, int mon, int mday, int hour, int min, int sec)
+{
+	if (unsigned(mon - 1) < 12 && unsigned(mday - 1) < 28 && hour < 24 && min < 60 && sec < 60)
+		return PackFields(year, mon, mday, hour, min, sec);
+	return PackTime(DaysFromCivilNorm(year, mon, mday) * 86400 + hour * 3600 + min * 60 + sec);
+}
+
+static void ParseTimeKeysScalar(char const* const* nows, size_t count, timekey *keys, bool *valid)
+{
+	for (size_t i = 0; i < count; i++)
+		valid[i] = ParseTimeKey(std::string_view(nows[i], NOW_SPEC_LENGTH), keys[i]);
+}
+
+/* "YYYY-MM-DDTHH:MM:SS" is 19 bytes, so it is looked at as two overlapping 16 byte blocks: bytes
+ * 0-15 and bytes 3-18. For each block, a lane either has to be a digit or has to equal the
+ * separator at that position. The digit pairs are then gathered with a byte shuffle and combined
+ * as tens * 10 + ones by a multiply-add, giving YY YY MM DD hh mm ss as 16 bit lanes.
+ */
+#define D 0
+static const unsigned char LAYOUT_LO[16] = { D,D,D,D,'-',D,D,'-',D,D,'T',D,D,':',D,D };
+static const unsigned char LAYOUT_HI[16] = { D,'-',D,D,'-',D,D,'T',D,D,':',D,D,':',D,D };
+#undef D
+// Lanes of each block that hold digits
+static const unsigned char DIGITS_LO[16] = { 1,1,1,1,0,1,1,0,1,1,0,1,1,0,1,1 };
+static const unsigned char DIGITS_HI[16] = { 1,0,1,1,0,1,1,0,1,1,0,1,1,0,1,1 };
+// Where the digit pairs come from, 0x80 (or out of range) leaves a zero
+static const unsigned char GATHER_LO[16] = { 0,1,2,3,5,6,8,9,11,12,14,15,0x80,0x80,0x80,0x80 };
+static const unsigned char GATHER_HI[16] = { 0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,0x80,
+		0x80,0x80,14,15,0x80,0x80 };
+static const signed char PAIR_WEIGHTS[16] = { 10,1,10,1,10,1,10,1,10,1,10,1,10,1,10,1 };
+
+static inline void PackLanes(int16_t const* f, timekey &key)
+{
+	key = PackParsed(f[0] * 100 + f[1], f[2], f[3], f[4], f[5], f[6]);
+}
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("sse4.1")))
+static inline __m128i CheckBlock128(__m128i c, __m128i layout, __m128i digits)
+{
+	__m128i d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+	__m128i is_digit = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+	__m128i is_sep = _mm_cmpeq_epi8(c, layout);
+	return _mm_blendv_epi8(is_sep, is_digit, digits);
+}
+
+__attribute__((target("sse4.1")))
+static void ParseTimeKeysSSE41(char const* const* nows, size_t count, timekey *keys, bool *valid)
+{
+	const __m128i layout_lo = _mm_loadu_si128(reinterpret_cast<__m128i const*>(LAYOUT_LO));
+	const __m128i layout_hi = _mm_loadu_si128(reinterpret_cast<__m128i const*>(LAYOUT_HI));
+	const __m128i digits_lo = _mm_cmpgt_epi8(
+			_mm_loadu_si128(reinterpret_cast<__m128i const*>(DIGITS_LO)), _mm_setzero_si128());
+	const __m128i digits_hi = _mm_cmpgt_epi8(
+			_mm_loadu_si128(reinterpret_cast<__m128i const*>(DIGITS_HI)), _mm_setzero_si128());
+	const __m128i gather_lo = _mm_loadu_si128(reinterpret_cast<__m128i const*>(GATHER_LO));
+	const __m128i gather_hi = _mm_loadu_si128(reinterpret_cast<__m128i const*>(GATHER_HI));
+	const __m128i weights = _mm_loadu_si128(reinterpret_cast<__m128i const*>(PAIR_WEIGHTS));
+	const __m128i zero = _mm_set1_epi8('0');
+
+	for (size_t i = 0; i < count; i++) {
+		__m128i lo = _mm_loadu_si128(reinterpret_cast<__m128i const*>(nows[i]));
+		__m128i hi = _mm_loadu_si128(reinterpret_cast<__m128i const*>(nows[i] + 3));
+		__m128i ok = _mm_and_si128(CheckBlock128(lo, layout_lo, digits_lo),
+				CheckBlock128(hi, layout_hi, digits_hi));
+		valid[i] = _mm_movemask_epi8(ok) == 0xffff;
+		if (!valid[i])
+			continue;
+
+		__m128i pairs = _mm_or_si128(_mm_shuffle_epi8(_mm_sub_epi8(lo, zero), gather_lo),
+				_mm_shuffle_epi8(_mm_sub_epi8(hi, zero), gather_hi));
+		alignas(16) int16_t fields[8];
+		_mm_store_si128(reinterpret_cast<__m128i *>(fields), _mm_maddubs_epi16(pairs, weights));
+		PackLanes(fields, keys[i]);
+	}
+}
+
+__attribute__((target("avx2")))
+static inline __m256i Twice(void const* table)
+{
+	return _mm256_broadcastsi128_si256(_mm_loadu_si128(static_cast<__m128i const*>(table)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i Load2(char const* a, char const* b)
+{
+	return _mm256_inserti128_si256(_mm256_castsi128_si256(
+			_mm_loadu_si128(reinterpret_cast<__m128i const*>(a))),
+			_mm_loadu_si128(reinterpret_cast<__m128i const*>(b)), 1);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i CheckBlock256(__m256i c, __m256i layout, __m256i digits)
+{
+	__m256i d = _mm256_sub_epi8(c, _mm256_set1_epi8('0'));
+	__m256i is_digit = _mm256_cmpeq_epi8(_mm256_min_epu8(d, _mm256_set1_epi8(9)), d);
+	return _mm256_blendv_epi8(_mm256_cmpeq_epi8(c, layout), is_digit, digits);
+}
+
+// Two names per iteration, one in each 128 bit lane. Byte shuffles stay within their lane, so
+// the tables are just the SSE ones twice.
+__attribute__((target("avx2")))
+static void ParseTimeKeysAVX2(char const* const* nows, size_t count, timekey *keys, bool *valid)
+{
+	const __m256i layout_lo = Twice(LAYOUT_LO);
+	const __m256i layout_hi = Twice(LAYOUT_HI);
+	const __m256i digits_lo = _mm256_cmpgt_epi8(Twice(DIGITS_LO), _mm256_setzero_si256());
+	const __m256i digits_hi = _mm256_cmpgt_epi8(Twice(DIGITS_HI), _mm256_setzero_si256());
+	const __m256i gather_lo = Twice(GATHER_LO);
+	const __m256i gather_hi = Twice(GATHER_HI);
+	const __m256i weights = Twice(PAIR_WEIGHTS);
+	const __m256i zero = _mm256_set1_epi8('0');
+
+	size_t i = 0;
+	for (; i + 2 <= count; i += 2) {
+		__m256i lo = Load2(nows[i], nows[i + 1]);
+		__m256i hi = Load2(nows[i] + 3, nows[i + 1] + 3);
+		unsigned ok = unsigned(_mm256_movemask_epi8(_mm256_and_si256(
+				CheckBlock256(lo, layout_lo, digits_lo), CheckBlock256(hi, layout_hi, digits_hi))));
+		valid[i] = (ok & 0xffff) == 0xffff;
+		valid[i + 1] = (ok >> 16) == 0xffff;
+		if (!valid[i] && !valid[i + 1])
+			continue;
+
+		__m256i pairs = _mm256_or_si256(_mm256_shuffle_epi8(_mm256_sub_epi8(lo, zero), gather_lo),
+				_mm256_shuffle_epi8(_mm256_sub_epi8(hi, zero), gather_hi));
+		alignas(32) int16_t fields[16];
+		_mm256_store_si256(reinterpret_cast<__m256i *>(fields), _mm256_maddubs_epi16(pairs, weights));
+		if (valid[i])
+			PackLanes(fields, keys[i]);
+		if (valid[i + 1])
+			PackLanes(fields + 8, keys[i + 1]);
+	}
+	ParseTimeKeysSSE41(nows + i, count - i, keys + i, valid + i);
+}
+
+#endif
+
+#ifdef HAVE_NEON
+
+static void ParseTimeKeysNEON(char const* const* nows, size_t count, timekey *keys, bool *valid)
+{
+	const uint8x16_t layout_lo = vld1q_u8(LAYOUT_LO);
+	const uint8x16_t layout_hi = vld1q_u8(LAYOUT_HI);
+	const uint8x16_t digits_lo = vcgtq_u8(vld1q_u8(DIGITS_LO), vdupq_n_u8(0));
+	const uint8x16_t digits_hi = vcgtq_u8(vld1q_u8(DIGITS_HI), vdupq_n_u8(0));
+	const uint8x16_t gather_lo = vld1q_u8(GATHER_LO);
+	const uint8x16_t gather_hi = vld1q_u8(GATHER_HI);
+	const uint8x16_t zero = vdupq_n_u8('0');
+	const uint8x16_t nine = vdupq_n_u8(9);
+
+	auto check = [&](uint8x16_t c, uint8x16_t layout, uint8x16_t digits) {
+		uint8x16_t is_digit = vcleq_u8(vsubq_u8(c, zero), nine);
+		return vbslq_u8(digits, is_digit, vceqq_u8(c, layout));
+	};
+
+	for (size_t i = 0; i < count; i++) {
+		uint8x16_t lo = vld1q_u8(reinterpret_cast<uint8_t const*>(nows[i]));
+		uint8x16_t hi = vld1q_u8(reinterpret_cast<uint8_t const*>(nows[i] + 3));
+		valid[i] = vminvq_u8(vandq_u8(check(lo, layout_lo, digits_lo),
+				check(hi, layout_hi, digits_hi))) == 0xff;
+		if (!valid[i])
+			continue;
+
+		// Out of range indices give zero with tbl, same as 0x80 with pshufb
+		uint8x16_t pairs = vorrq_u8(vqtbl1q_u8(vsubq_u8(lo, zero), gather_lo),
+				vqtbl1q_u8(vsubq_u8(hi, zero), gather_hi));
+		// tens are the even bytes, ones the odd ones
+		uint8x8x2_t split = vuzp_u8(vget_low_u8(pairs), vget_high_u8(pairs));
+		uint16x8_t values = vmlal_u8(vmovl_u8(split.val[1]), split.val[0], vdup_n_u8(10));
+		int16_t fields[8];
+		vst1q_s16(fields, vreinterpretq_s16_u16(values));
+		PackLanes(fields, keys[i]);
+	}
+}
+
+#endif
+
+typedef void (*parse_kernel)(char const* const*, size_t, timekey *, bool *);
+
+static parse_kernel PickKernel()
+{
+#ifdef HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return ParseTimeKeysAVX2;
+	if (__builtin_cpu_supports("sse4.1"))
+		return ParseTimeKeysSSE41;
+#endif
+#ifdef HAVE_NEON
+	return ParseTimeKeysNEON;
+#endif
+	return ParseTimeKeysScalar;
+}
+
+void ParseTimeKeys(char const* const* nows, size_t count, timekey *keys, bool *valid)
+{
+	static const parse_kernel kernel = PickKernel();
+	kernel(nows, count, keys, valid);
+}
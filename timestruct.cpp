@@ -0,0 +1,123 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "timestruct.h"
+
+#include <exception>
+#include <stdexcept>
+
+#include "civil.h"
+#include "localzone.h"
+
+using std::chrono::system_clock;
+
+
+char const BAD_NOW_FORMAT[] = "{now} is not the correct time format";
+
+
+timestruct::timestruct(system_clock::time_point time_point)
+	: timestruct(time_point, LocalZone::Get().OffsetAt(system_clock::to_time_t(time_point)))
+{
+}
+
+timestruct::timestruct(system_clock::time_point time_point, int64_t utc_offset)
+	: tp(time_point)
+{
+	int64_t local = system_clock::to_time_t(tp) + utc_offset;
+	int64_t days = FloorDiv(local, 86400);
+	int64_t daysec = local - days * 86400;
+	civil_date date = CivilFromDays(days);
+
+	sec = daysec % 60;
+	min = daysec / 60 % 60;
+	hour = daysec / 3600;
+	mday = date.mday;
+	mon = date.mon;
+	year = date.year;
+	yday = YearDay(days);
+	week = yday / 7; // Not the ISO 8601 weekly calendar, but it's good enough for backups
+}
+
+timestruct::timestruct(std::string_view intime)
+{
+	if (!ParseNowSpec(intime, year, mon, mday, hour, min, sec))
+		throw std::invalid_argument(BAD_NOW_FORMAT);
+
+	// Out of range fields carry over into the next larger one, the same way mktime normalizes
+	// them. The fields themselves are kept as they were written.
+	int64_t local = DaysFromCivilNorm(year, mon, mday) * 86400 + hour * 3600 + min * 60 + sec;
+	// Names don't say whether DST was in effect, so a time the clocks went back over is ambiguous.
+	// LocalZone settles that the same way every time.
+	tp = system_clock::from_time_t(LocalZone::Get().LocalToUtc(local));
+	yday = YearDay(FloorDiv(local, 86400));
+	week = yday / 7;
+}
+
+// Mask is actually a selection mask, so if the bit is set that comparison will matter
+bool timestruct::EqlMask(timestruct const& rhs, uint64_t mask)
+{
+	bool retval = true;
+	if (mask & MINUTES)
+		retval = retval && (min == rhs.min);
+	if (mask & HOURS)
+		retval = retval && (hour == rhs.hour);
+	if (mask & MONTHDAYS)
+		retval = retval && (mday == rhs.mday);
+	if (mask & MONTHS)
+		retval = retval && (mon == rhs.mon);
+	if (mask & YEARS)
+		retval = retval && (year == rhs.year);
+	if (mask & WEEKS)
+		retval = retval && (week == rhs.week);
+	return retval;
+}
+
+bool SortTimestruct(timestruct const& lhs, timestruct const& rhs)
+{
+	return lhs.tp < rhs.tp;
+}
+
+
+// 'd' is a digit, anything else has to match exactly.
+static const char now_layout[] = "dddd-dd-ddTdd:dd:dd";
+static_assert(sizeof(now_layout) - 1 == NOW_SPEC_LENGTH, "layout must match NOW_SPEC_LENGTH");
+
+bool ParseNowSpec(std::string_view intime, int &year, int &mon, int &mday,
+		int &hour, int &min, int &sec)
+{
+	if (intime.size() != NOW_SPEC_LENGTH)
+		return false;
+
+	// Check every position before converting anything. Unsigned wraparound makes anything below
+	// '0' fail the same comparison as anything above '9'.
+	for (size_t i = 0; i < NOW_SPEC_LENGTH; i++) {
+		unsigned char c = intime[i];
+		if (now_layout[i] == 'd') {
+			if (unsigned(c - '0') > 9)
+				return false;
+		}
+		else if (c != now_layout[i]) {
+			return false;
+		}
+	}
+
+	auto d = [&intime](size_t i) { return intime[i] - '0'; };
+	year = d(0) * 1000 + d(1) * 100 + d(2) * 10 + d(3);
+	mon = d(5) * 10 + d(6);
+	mday = d(8) * 10 + d(9);
+	hour = d(11) * 10 + d(12);
+	min = d(14) * 10 + d(15);
+	sec = d(17) * 10 + d(18);
+	return true;
+}
@@ -0,0 +1,77 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <chrono>
+#include <string>
+#include <string_view>
+
+
+/* Time comparison mask values. Specifies what needs to be checked when comparing time values
+ */
+enum timecomp : uint64_t {
+	MINUTES   = 1 << 1,
+	HOURS     = 1 << 2,
+	MONTHDAYS = 1 << 3,
+	MONTHS    = 1 << 4,
+	YEARS     = 1 << 5,
+	WEEKS     = 1 << 6,
+
+	COMP_YEARLY = YEARS,
+	COMP_MONTHLY = COMP_YEARLY | MONTHS,
+	COMP_DAILY = COMP_MONTHLY | MONTHDAYS,
+	COMP_HOURLY = COMP_DAILY | HOURS,
+	COMP_MINUTELY = COMP_HOURLY | MINUTES,
+	// Weeks can't be defined in the same cascading fashion.
+	COMP_WEEKLY = YEARS | WEEKS,
+};
+
+// length of "2020-01-12T13:45:00"
+const size_t NOW_SPEC_LENGTH = 19;
+
+// Reason given when a {now} value isn't in the format above.
+extern char const BAD_NOW_FORMAT[];
+
+struct timestruct {
+	int sec;  // seconds after the minute (0-60)
+	int min;  // minutes after the hour (0-59)
+	int hour; // hours since midnight (0-23)
+	int mday; // day of the month (1-31)
+	int mon;  // month (1-12)
+	int year; // year
+	int yday; // day of year (0-365)
+	int week; // week of year (0-52)
+
+	std::chrono::system_clock::time_point tp;
+
+	// Local time
+	timestruct(std::chrono::system_clock::time_point time_point);
+	// The time utc_offset seconds ahead of UTC, without looking at the time zone
+	timestruct(std::chrono::system_clock::time_point time_point, int64_t utc_offset);
+	timestruct(std::string_view intime);
+
+	bool EqlMask(timestruct const& rhs, uint64_t mask);
+};
+
+bool SortTimestruct(timestruct const& lhs, timestruct const& rhs);
+
+/* Parses the fixed "YYYY-MM-DDTHH:MM:SS" layout in a single pass without allocating. Accepts
+ * exactly what the regex (\d{4})-(\d{2})-(\d{2})T(\d{2}):(\d{2}):(\d{2}) accepts. Returns false
+ * if intime is not in that format, in which case the output fields are left untouched.
+ */
+bool ParseNowSpec(std::string_view intime, int &year, int &mon, int &mday,
+		int &hour, int &min, int &sec);
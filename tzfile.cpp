@@ -0,0 +1,342 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "tzfile.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+#include "civil.h"
+
+using std::string;
+
+
+/* POSIX TZ strings */
+
+static bool ParseName(std::string_view &s)
+{
+	size_t n = 0;
+	if (!s.empty() && s[0] == '<') {
+		n = s.find('>');
+		if (n == std::string_view::npos)
+			return false;
+		s.remove_prefix(n + 1);
+		return n > 1;
+	}
+	while (n < s.size() && ((s[n] >= 'a' && s[n] <= 'z') || (s[n] >= 'A' && s[n] <= 'Z')))
+		n++;
+	s.remove_prefix(n);
+	return n >= 3;
+}
+
+static bool ParseNumber(std::string_view &s, int64_t &value, int64_t max)
+{
+	size_t n = 0;
+	value = 0;
+	while (n < s.size() && s[n] >= '0' && s[n] <= '9') {
+		value = value * 10 + (s[n] - '0');
+		if (value > max)
+			return false;
+		n++;
+	}
+	s.remove_prefix(n);
+	return n > 0;
+}
+
+// [+-]hh[:mm[:ss]], hours up to 167 as the TZif extension allows
+static bool ParseTime(std::string_view &s, int64_t &secs)
+{
+	int64_t sign = 1;
+	if (!s.empty() && (s[0] == '+' || s[0] == '-')) {
+		sign = s[0] == '-' ? -1 : 1;
+		s.remove_prefix(1);
+	}
+	int64_t h, m = 0, sec = 0;
+	if (!ParseNumber(s, h, 167))
+		return false;
+	if (!s.empty() && s[0] == ':') {
+		s.remove_prefix(1);
+		if (!ParseNumber(s, m, 59))
+			return false;
+		if (!s.empty() && s[0] == ':') {
+			s.remove_prefix(1);
+			if (!ParseNumber(s, sec, 59))
+				return false;
+		}
+	}
+	secs = sign * (h * 3600 + m * 60 + sec);
+	return true;
+}
+
+static bool ParseRuleDate(std::string_view &s, posixrule::ruledate &date)
+{
+	int64_t v;
+	date.time = 2 * 3600;
+	date.mon = date.week = 0;
+	if (!s.empty() && s[0] == 'J') {
+		s.remove_prefix(1);
+		if (!ParseNumber(s, v, 365) || v < 1)
+			return false;
+		date.kind = posixrule::ruledate::JULIAN_NOLEAP;
+		date.day = int(v);
+	}
+	else if (!s.empty() && s[0] == 'M') {
+		int64_t mon, week, day;
+		s.remove_prefix(1);
+		if (!ParseNumber(s, mon, 12) || mon < 1 || s.empty() || s[0] != '.')
+			return false;
+		s.remove_prefix(1);
+		if (!ParseNumber(s, week, 5) || week < 1 || s.empty() || s[0] != '.')
+			return false;
+		s.remove_prefix(1);
+		if (!ParseNumber(s, day, 6))
+			return false;
+		date.kind = posixrule::ruledate::MONTH_WEEK_DAY;
+		date.mon = int(mon);
+		date.week = int(week);
+		date.day = int(day);
+	}
+	else {
+		if (!ParseNumber(s, v, 365))
+			return false;
+		date.kind = posixrule::ruledate::JULIAN;
+		date.day = int(v);
+	}
+	if (!s.empty() && s[0] == '/') {
+		s.remove_prefix(1);
+		return ParseTime(s, date.time);
+	}
+	return true;
+}
+
+bool ParsePosixRule(std::string_view s, posixrule &rule)
+{
+	int64_t offset;
+	if (!ParseName(s) || !ParseTime(s, offset))
+		return false;
+	// POSIX offsets count west of UTC
+	rule.std_offset = -offset;
+	rule.has_dst = false;
+	rule.dst_offset = rule.std_offset;
+	if (s.empty())
+		return true;
+
+	if (!ParseName(s))
+		return false;
+	rule.has_dst = true;
+	rule.dst_offset = rule.std_offset + 3600;
+	if (!s.empty() && s[0] != ',') {
+		if (!ParseTime(s, offset))
+			return false;
+		rule.dst_offset = -offset;
+	}
+	if (s.empty()) {
+		// No rule given, glibc falls back to the US one
+		s = ",M3.2.0,M11.1.0";
+	}
+	if (s[0] != ',')
+		return false;
+	s.remove_prefix(1);
+	if (!ParseRuleDate(s, rule.start) || s.empty() || s[0] != ',')
+		return false;
+	s.remove_prefix(1);
+	return ParseRuleDate(s, rule.end) && s.empty();
+}
+
+static bool IsLeap(int64_t year)
+{
+	return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+// Seconds from the start of year (local time) to date
+static int64_t RuleDateInYear(posixrule::ruledate const& date, int64_t year)
+{
+	int64_t day;
+	switch (date.kind) {
+	case posixrule::ruledate::JULIAN_NOLEAP:
+		day = date.day - 1 + (IsLeap(year) && date.day >= 60);
+		break;
+	case posixrule::ruledate::JULIAN:
+		day = date.day;
+		break;
+	default: {
+		int64_t first = DaysFromCivil(year, date.mon, 1);
+		int64_t month_len = DaysFromCivilNorm(year, date.mon + 1, 1) - first;
+		// 1970-01-01 was a Thursday
+		int64_t weekday = FloorMod(first + 4, 7);
+		int64_t mday = FloorMod(date.day - weekday, 7) + (date.week - 1) * 7;
+		while (mday >= month_len)
+			mday -= 7;
+		day = first + mday - DaysFromCivil(year, 1, 1);
+		break;
+	}
+	}
+	return day * 86400 + date.time;
+}
+
+int64_t PosixOffsetAt(posixrule const& rule, int64_t utc)
+{
+	if (!rule.has_dst)
+		return rule.std_offset;
+	int64_t year = CivilFromDays(FloorDiv(utc + rule.std_offset, 86400)).year;
+	int64_t year_start = DaysFromCivil(year, 1, 1) * 86400;
+	int64_t start = year_start + RuleDateInYear(rule.start, year) - rule.std_offset;
+	int64_t end = year_start + RuleDateInYear(rule.end, year) - rule.dst_offset;
+	bool dst = start < end ? (utc >= start && utc < end) : !(utc >= end && utc < start);
+	return dst ? rule.dst_offset : rule.std_offset;
+}
+
+
+/* TZif files, RFC 8536 */
+
+static uint32_t Be32(unsigned char const* p)
+{
+	return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+}
+
+static int64_t Be64(unsigned char const* p)
+{
+	return int64_t(uint64_t(Be32(p)) << 32 | Be32(p + 4));
+}
+
+ZoneTable::ZoneTable()
+	: initial_offset(0),
+	has_rule(false)
+{
+}
+
+bool ZoneTable::LoadTZif(std::string_view data)
+{
+	static const size_t HEADER = 44;
+	auto p = reinterpret_cast<unsigned char const*>(data.data());
+	size_t size = data.size();
+	if (size < HEADER || std::memcmp(p, "TZif", 4) != 0)
+		return false;
+
+	// Version 2+ repeat everything with 64 bit times after the version 1 block, use that one.
+	int time_size = 4;
+	auto counts = [&](unsigned char const* h, uint32_t c[6]) {
+		for (int i = 0; i < 6; i++)
+			c[i] = Be32(h + 20 + 4 * i);
+	};
+	// isutcnt, isstdcnt, leapcnt, timecnt, typecnt, charcnt
+	uint32_t c[6];
+	counts(p, c);
+	auto block_len = [&](int tsize) {
+		return uint64_t(c[3]) * tsize + c[3] + uint64_t(c[4]) * 6 + c[5]
+			+ uint64_t(c[2]) * (tsize + 4) + c[1] + c[0];
+	};
+	size_t pos = HEADER;
+	if (p[4] >= '2') {
+		pos += block_len(4);
+		if (pos + HEADER > size || std::memcmp(p + pos, "TZif", 4) != 0)
+			return false;
+		counts(p + pos, c);
+		pos += HEADER;
+		time_size = 8;
+	}
+	if (c[4] == 0 || pos + block_len(time_size) > size)
+		return false;
+
+	unsigned char const* trans = p + pos;
+	unsigned char const* idx = trans + size_t(c[3]) * time_size;
+	unsigned char const* types = idx + c[3];
+	std::vector<int64_t> type_offsets(c[4]);
+	for (uint32_t i = 0; i < c[4]; i++)
+		type_offsets[i] = int32_t(Be32(types + 6 * i));
+
+	times.clear();
+	offsets.clear();
+	initial_offset = type_offsets[0];
+	for (uint32_t i = 0; i < c[3]; i++) {
+		if (idx[i] >= c[4])
+			return false;
+		times.push_back(time_size == 8 ? Be64(trans + 8 * i) : int32_t(Be32(trans + 4 * i)));
+		offsets.push_back(type_offsets[idx[i]]);
+	}
+
+	// Footer: "\n<POSIX TZ>\n", possibly empty
+	has_rule = false;
+	pos += block_len(time_size);
+	if (time_size == 8 && pos < size && p[pos] == '\n') {
+		size_t end = data.find('\n', pos + 1);
+		if (end != std::string_view::npos && end > pos + 1)
+			has_rule = ParsePosixRule(data.substr(pos + 1, end - pos - 1), rule);
+	}
+	return true;
+}
+
+bool ZoneTable::LoadPosix(std::string_view tz)
+{
+	posixrule parsed;
+	if (!ParsePosixRule(tz, parsed))
+		return false;
+	times.clear();
+	offsets.clear();
+	initial_offset = parsed.std_offset;
+	rule = parsed;
+	has_rule = true;
+	return true;
+}
+
+static bool ReadFile(string const& path, string &data)
+{
+	std::ifstream in(path, std::ios::binary);
+	if (!in)
+		return false;
+	data.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+	return !in.bad();
+}
+
+ZoneTable ZoneTable::FromEnvironment()
+{
+	ZoneTable zone;
+	string data;
+	char const* tz = std::getenv("TZ");
+	if (!tz) {
+		if (ReadFile("/etc/localtime", data))
+			zone.LoadTZif(data);
+		return zone;
+	}
+
+	std::string_view name(tz);
+	if (!name.empty() && name[0] == ':')
+		name.remove_prefix(1);
+	if (name.empty())
+		return zone;
+	string path(name);
+	if (path[0] != '/') {
+		char const* dir = std::getenv("TZDIR");
+		path = string(dir && *dir ? dir : "/usr/share/zoneinfo") + "/" + path;
+	}
+	// Names with .. in them could point anywhere, glibc doesn't take them from TZ either
+	bool safe = name.find("..") == std::string_view::npos;
+	if (safe && ReadFile(path, data) && zone.LoadTZif(data))
+		return zone;
+	zone.LoadPosix(name);
+	return zone;
+}
+
+int64_t ZoneTable::OffsetAt(int64_t utc) const
+{
+	if (times.empty() || utc < times.front())
+		return has_rule && times.empty() ? PosixOffsetAt(rule, utc) : initial_offset;
+	if (has_rule && utc >= times.back())
+		return PosixOffsetAt(rule, utc);
+	size_t i = std::upper_bound(times.begin(), times.end(), utc) - times.begin();
+	return offsets[i - 1];
+}
@@ -0,0 +1,77 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+/* A POSIX TZ rule like "CET-1CEST,M3.5.0,M10.5.0/3", as found in TZ or at the end of a TZif
+ * file. Offsets are seconds east of UTC, unlike the TZ string itself.
+ */
+struct posixrule {
+	// When during the year DST starts or ends, in local time of the offset in effect before it
+	struct ruledate {
+		enum { JULIAN_NOLEAP, JULIAN, MONTH_WEEK_DAY } kind;
+		int day;   // Jn: 1-365, n: 0-365, Mm.w.d: weekday 0-6
+		int mon;   // Mm.w.d only
+		int week;  // Mm.w.d only, 5 is the last
+		int64_t time;
+	};
+
+	int64_t std_offset;
+	bool has_dst;
+	int64_t dst_offset;
+	ruledate start;
+	ruledate end;
+};
+
+// Returns false if tz isn't a valid POSIX TZ string.
+bool ParsePosixRule(std::string_view tz, posixrule &rule);
+
+int64_t PosixOffsetAt(posixrule const& rule, int64_t utc);
+
+/* Every UTC offset change of a timezone, from the system tzdb (TZif files, versions 1-3) or a
+ * POSIX TZ string. Past the last listed transition the TZif footer rule, if any, takes over.
+ * Leap second records are ignored, the same way localtime does for the posix/ zones.
+ */
+class ZoneTable {
+public:
+	// UTC
+	ZoneTable();
+
+	/* Loads the zone the way glibc resolves TZ: unset means /etc/localtime, otherwise a file
+	 * under TZDIR (or an absolute path), otherwise a POSIX TZ string. Becomes UTC if none of
+	 * that works out, which is also what localtime does then.
+	 */
+	static ZoneTable FromEnvironment();
+	// Returns false if data isn't a TZif file.
+	bool LoadTZif(std::string_view data);
+	bool LoadPosix(std::string_view tz);
+
+	int64_t OffsetAt(int64_t utc) const;
+
+	// Transition instants and the offsets they switch to, oldest first
+	std::vector<int64_t> const& Transitions() const { return times; }
+
+private:
+	int64_t initial_offset;
+	std::vector<int64_t> times;
+	std::vector<int64_t> offsets;
+	bool has_rule;
+	posixrule rule;
+};
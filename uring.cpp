@@ -0,0 +1,225 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "uring.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <system_error>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+
+#include "delete.h"
+
+using std::string;
+
+
+UnlinkRing::UnlinkRing(int dirfd, fallback_fn fallback)
+	: dirfd(dirfd),
+	fallback(std::move(fallback)),
+	ring_fd(-1),
+	sq_map(MAP_FAILED),
+	sq_map_len(0),
+	cq_map(MAP_FAILED),
+	cq_map_len(0),
+	sqe_map(MAP_FAILED),
+	sqe_map_len(0),
+	sq_head(nullptr),
+	sq_tail(nullptr),
+	sq_mask(0),
+	sq_array(nullptr),
+	cq_head(nullptr),
+	cq_tail(nullptr),
+	cq_mask(0),
+	cqes(nullptr),
+	batch(1),
+	to_submit(0),
+	in_flight(0)
+{
+}
+
+UnlinkRing::~UnlinkRing()
+{
+	if (ring_fd >= 0 && in_flight) {
+		// The kernel may still read names out of slots
+		try {
+			Finish();
+		}
+		catch (...) {
+		}
+	}
+	if (sqe_map != MAP_FAILED)
+		munmap(sqe_map, sqe_map_len);
+	if (cq_map != MAP_FAILED && cq_map != sq_map)
+		munmap(cq_map, cq_map_len);
+	if (sq_map != MAP_FAILED)
+		munmap(sq_map, sq_map_len);
+	if (ring_fd >= 0)
+		close(ring_fd);
+}
+
+std::unique_ptr<UnlinkRing> UnlinkRing::Create(int dirfd, unsigned entries, fallback_fn fallback)
+{
+	std::unique_ptr<UnlinkRing> ring(new UnlinkRing(dirfd, std::move(fallback)));
+	if (!ring->Setup(entries))
+		return nullptr;
+	return ring;
+}
+
+#ifdef HAVE_IO_URING
+
+static unsigned *RingField(void *map, unsigned offset)
+{
+	return reinterpret_cast<unsigned *>(static_cast<char *>(map) + offset);
+}
+
+bool UnlinkRing::Setup(unsigned entries)
+{
+	io_uring_params params;
+	std::memset(&params, 0, sizeof(params));
+	// Fails with ENOSYS on old kernels and EPERM where io_uring is disabled or filtered
+	ring_fd = int(syscall(__NR_io_uring_setup, entries, &params));
+	if (ring_fd < 0)
+		return false;
+
+	sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		sq_map_len = cq_map_len = std::max(sq_map_len, cq_map_len);
+	sq_map = mmap(nullptr, sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ring_fd, IORING_OFF_SQ_RING);
+	if (sq_map == MAP_FAILED)
+		return false;
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+		cq_map = sq_map;
+	else {
+		cq_map = mmap(nullptr, cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				ring_fd, IORING_OFF_CQ_RING);
+		if (cq_map == MAP_FAILED)
+			return false;
+	}
+	sqe_map_len = params.sq_entries * sizeof(io_uring_sqe);
+	sqe_map = mmap(nullptr, sqe_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ring_fd, IORING_OFF_SQES);
+	if (sqe_map == MAP_FAILED)
+		return false;
+
+	sq_head = RingField(sq_map, params.sq_off.head);
+	sq_tail = RingField(sq_map, params.sq_off.tail);
+	sq_mask = *RingField(sq_map, params.sq_off.ring_mask);
+	sq_array = RingField(sq_map, params.sq_off.array);
+	cq_head = RingField(cq_map, params.cq_off.head);
+	cq_tail = RingField(cq_map, params.cq_off.tail);
+	cq_mask = *RingField(cq_map, params.cq_off.ring_mask);
+	cqes = static_cast<char *>(cq_map) + params.cq_off.cqes;
+
+	// Never more requests out than the submission queue holds, so the completion queue can't overflow
+	slots.resize(params.sq_entries);
+	for (unsigned i = params.sq_entries; i > 0; i--)
+		free_slots.push_back(i - 1);
+	batch = std::max(1u, params.sq_entries / 2);
+	return true;
+}
+
+void UnlinkRing::Add(std::string_view name)
+{
+	if (free_slots.empty()) {
+		Reap();
+		// Wait for a whole batch to free up, so the next few Add()s don't each have to wait
+		while (free_slots.empty())
+			Enter(std::min(in_flight, batch));
+	}
+
+	unsigned slot = free_slots.back();
+	free_slots.pop_back();
+	slots[slot].assign(name.data(), name.size());
+
+	// Only this thread produces, so the tail can be read plainly
+	unsigned tail = *sq_tail;
+	unsigned index = tail & sq_mask;
+	io_uring_sqe *sqe = static_cast<io_uring_sqe *>(sqe_map) + index;
+	std::memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_UNLINKAT;
+	sqe->fd = dirfd;
+	sqe->addr = reinterpret_cast<uint64_t>(slots[slot].c_str());
+	sqe->unlink_flags = 0;
+	sqe->user_data = slot;
+	sq_array[index] = index;
+	__atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+	to_submit++;
+	in_flight++;
+	if (to_submit >= batch)
+		Enter(0);
+}
+
+void UnlinkRing::Enter(unsigned wait_for)
+{
+	for (;;) {
+		long ret = syscall(__NR_io_uring_enter, ring_fd, to_submit, wait_for,
+				wait_for ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+		if (ret >= 0) {
+			to_submit -= unsigned(ret);
+			break;
+		}
+		if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			throw std::system_error(errno, std::generic_category(), "io_uring_enter failed");
+	}
+	Reap();
+}
+
+void UnlinkRing::Reap()
+{
+	unsigned head = *cq_head;
+	unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+	for (; head != tail; head++) {
+		io_uring_cqe const& cqe = static_cast<io_uring_cqe *>(cqes)[head & cq_mask];
+		unsigned slot = unsigned(cqe.user_data);
+		if (cqe.res == 0)
+			ReportDelete(slots[slot], 0);
+		else
+			// The synchronous path sorts out directories and subvolumes, and reports real errors
+			fallback(slots[slot]);
+		free_slots.push_back(slot);
+		in_flight--;
+	}
+	__atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+}
+
+void UnlinkRing::Finish()
+{
+	while (in_flight)
+		Enter(in_flight);
+}
+
+#else
+
+bool UnlinkRing::Setup(unsigned)
+{
+	return false;
+}
+
+void UnlinkRing::Add(std::string_view) {}
+void UnlinkRing::Enter(unsigned) {}
+void UnlinkRing::Reap() {}
+void UnlinkRing::Finish() {}
+
+#endif
@@ -0,0 +1,81 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+/* Unlinks names relative to a directory with IORING_OP_UNLINKAT, submitting them in batches
+ * instead of one syscall per name. Talks to the kernel with the raw syscalls, there is no
+ * liburing dependency. Not thread safe, Add() and Finish() belong to one thread.
+ */
+class UnlinkRing {
+public:
+	// Called for every name the ring couldn't unlink (directories, or kernels without the opcode)
+	typedef std::function<void(std::string const&)> fallback_fn;
+
+	// Returns nullptr when io_uring isn't available, so the caller can stay synchronous.
+	static std::unique_ptr<UnlinkRing> Create(int dirfd, unsigned entries, fallback_fn fallback);
+	~UnlinkRing();
+
+	UnlinkRing(UnlinkRing const&) =delete;
+	UnlinkRing& operator=(UnlinkRing const&) =delete;
+
+	void Add(std::string_view name);
+	// Waits for every submitted unlink to complete.
+	void Finish();
+
+private:
+	UnlinkRing(int dirfd, fallback_fn fallback);
+	bool Setup(unsigned entries);
+	/* Submits whatever is queued, waits until at least wait_for unlinks have completed and reaps
+	 * all that are done.
+	 */
+	void Enter(unsigned wait_for);
+	void Reap();
+
+	int dirfd;
+	fallback_fn fallback;
+	int ring_fd;
+
+	// Mapped rings
+	void *sq_map;
+	size_t sq_map_len;
+	void *cq_map;
+	size_t cq_map_len;
+	void *sqe_map;
+	size_t sqe_map_len;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	void *cqes;
+
+	// Names stay here until their unlink completes, user_data is the slot index
+	std::vector<std::string> slots;
+	std::vector<unsigned> free_slots;
+	// Queued unlinks are submitted once there are this many, half the ring
+	unsigned batch;
+	unsigned to_submit;
+	unsigned in_flight;
+};
@@ -0,0 +1,139 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#include "watch.h"
+
+#include <cerrno>
+#include <stdexcept>
+#include <system_error>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+#include "dirscan.h"
+#include "input.h"
+
+using std::string;
+
+
+static std::system_error WatchError(string const& what)
+{
+	return std::system_error(errno, std::generic_category(), what);
+}
+
+// Closes a descriptor on the way out
+struct FdCloser {
+	int fd;
+	~FdCloser() { if (fd >= 0) close(fd); }
+};
+
+sigset_t BlockStopSignals()
+{
+	sigset_t stop;
+	sigemptyset(&stop);
+	sigaddset(&stop, SIGINT);
+	sigaddset(&stop, SIGTERM);
+	sigaddset(&stop, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &stop, nullptr);
+	return stop;
+}
+
+// Events mostly come one or two at a time, but a burst can fill a queue of thousands
+static const size_t EVENT_BUFFER_SIZE = 64 * 1024;
+
+static const uint32_t ARRIVED = IN_CREATE | IN_MOVED_TO;
+static const uint32_t LEFT = IN_DELETE | IN_MOVED_FROM;
+static const uint32_t WATCH_GONE = IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT | IN_IGNORED;
+
+void WatchDirectory(int dirfd, string const& path, CompiledSpec const& spec, char delim,
+		std::vector<keeptier> const& tiers, sigset_t const& stop,
+		RetentionIndex::prune_fn prune, std::function<void()> flush)
+{
+	LineParser parser(spec);
+	RetentionIndex index(tiers, std::move(prune));
+
+	FdCloser notify{ inotify_init1(IN_CLOEXEC | IN_NONBLOCK) };
+	if (notify.fd < 0)
+		throw WatchError("failed to watch '" + path + "'");
+	// Watch first so nothing that arrives during the listing is missed, duplicates are ignored.
+	if (inotify_add_watch(notify.fd, path.c_str(), ARRIVED | LEFT | IN_DELETE_SELF | IN_MOVE_SELF
+			| IN_ONLYDIR) < 0)
+		throw WatchError("failed to watch '" + path + "'");
+	FdCloser signals{ signalfd(-1, &stop, SFD_CLOEXEC) };
+	if (signals.fd < 0)
+		throw WatchError("failed to watch '" + path + "'");
+
+	auto add = [&parser, &index](std::string_view name) {
+		timekey key;
+		if (parser.Parse(name, key))
+			index.Insert(key, name);
+	};
+	auto rescan = [&]() {
+		if (lseek(dirfd, 0, SEEK_SET) < 0)
+			throw WatchError("failed to read directory '" + path + "'");
+		// Entries that were deleted behind our back must not stay around as bucket heads
+		index.Clear();
+		ForEachLine(ScanDirectory(dirfd, spec, delim), delim, add);
+	};
+
+	rescan();
+	std::vector<char> buf(EVENT_BUFFER_SIZE);
+	for (;;) {
+		index.Update();
+		flush();
+
+		pollfd fds[2] = { { notify.fd, POLLIN, 0 }, { signals.fd, POLLIN, 0 } };
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			throw WatchError("failed to watch '" + path + "'");
+		}
+		if (fds[1].revents)
+			return;
+
+		bool overflow = false;
+		for (;;) {
+			ssize_t len = read(notify.fd, buf.data(), buf.size());
+			if (len < 0) {
+				if (errno == EINTR)
+					continue;
+				if (errno == EAGAIN)
+					break;
+				throw WatchError("failed to watch '" + path + "'");
+			}
+			for (char const* p = buf.data(); p < buf.data() + len; ) {
+				inotify_event const* ev = reinterpret_cast<inotify_event const*>(p);
+				p += sizeof(inotify_event) + ev->len;
+				if (ev->mask & IN_Q_OVERFLOW)
+					overflow = true;
+				if (ev->mask & WATCH_GONE)
+					throw std::runtime_error("watched directory '" + path + "' went away");
+				if (!ev->len)
+					continue;
+				std::string_view name(ev->name);
+				// Same filter as ScanDirectory, anything else is none of our business
+				if (!spec.Matches(name) || name.find(delim) != std::string_view::npos)
+					continue;
+				if (ev->mask & ARRIVED)
+					add(name);
+				else if (ev->mask & LEFT)
+					index.Erase(name);
+			}
+		}
+		if (overflow)
+			rescan();
+	}
+}
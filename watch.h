@@ -0,0 +1,43 @@
+/* Copyright 2022 Peter Luick
+
+   Licensed under the Apache License, Version 2.0 (the "License");
+   you may not use this file except in compliance with the License.
+   You may obtain a copy of the License at
+
+       http://www.apache.org/licenses/LICENSE-2.0
+
+   Unless required by applicable law or agreed to in writing, software
+   distributed under the License is distributed on an "AS IS" BASIS,
+   WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+   See the License for the specific language governing permissions and
+   limitations under the License.
+*/
+#pragma once
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <signal.h>
+
+#include "prune.h"
+#include "retention.h"
+#include "spec.h"
+
+
+/* Blocks the signals that end --watch (SIGINT, SIGTERM, SIGHUP) and returns them. Has to be
+ * called before any other thread is started, so none of them gets the signals instead.
+ */
+sigset_t BlockStopSignals();
+
+/* Keeps the directory dirfd (opened from path) pruned until one of stop arrives. The directory is
+ * listed once, after that only inotify events are looked at: arrivals are added to a
+ * RetentionIndex and whatever they push out is handed to prune right away. flush is called
+ * whenever a batch of events has been dealt with. On an event queue overflow the directory is
+ * listed again, and anything that is still there and pruned is handed to prune again. Names
+ * with delim in them are skipped like ScanDirectory does. Throws std::system_error on failure
+ * and std::runtime_error if the directory goes away.
+ */
+void WatchDirectory(int dirfd, std::string const& path, CompiledSpec const& spec, char delim,
+		std::vector<keeptier> const& tiers, sigset_t const& stop,
+		RetentionIndex::prune_fn prune, std::function<void()> flush);